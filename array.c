@@ -0,0 +1,666 @@
+#include "hll.h"
+#include "batch.h"
+#include "estimate.h"
+#include "hash.h"
+#include "registers.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Rows are merged this many bytes of registers at a time. */
+#define HLL_ARRAY_MERGE_BLOCK (1 << 30)
+
+/* n HyperLogLogs of the same size, indexed 0 to n - 1, with their registers
+ * in one block: row i starts at registers + i * size. */
+typedef struct {
+    PyObject_HEAD
+    short int k;        /* size = 2^k */
+    uint32_t seed;      /* hash seed */
+    int hash;           /* hash function, see hash.h */
+    uint32_t size;      /* number of registers per row */
+    Py_ssize_t rows;    /* number of rows */
+    char *registers;    /* rows * size ranks */
+} HyperLogLogArray;
+
+static inline char *
+row_registers(HyperLogLogArray *self, Py_ssize_t row)
+{
+    return self->registers + (size_t) row * self->size;
+}
+
+static void
+HyperLogLogArray_dealloc(HyperLogLogArray *self)
+{
+    free(self->registers);
+    #if PY_MAJOR_VERSION >= 3
+    Py_TYPE(self)->tp_free((PyObject*) self);
+    #else
+    self->ob_type->tp_free((PyObject*) self);
+    #endif
+}
+
+static PyObject *
+HyperLogLogArray_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    HyperLogLogArray *self;
+    self = (HyperLogLogArray *)type->tp_alloc(type, 0);
+    self->seed = 314;
+    return (PyObject *)self;
+}
+
+static int
+HyperLogLogArray_init(HyperLogLogArray *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"n", "k", "seed", "hash", NULL};
+    const char *hash = NULL;
+    Py_ssize_t rows;
+    uint32_t seed = 314;
+    int k, hashId = HLL_HASH_MURMUR3;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ni|Is", kwlist,
+                                     &rows, &k, &seed, &hash))
+        return -1;
+
+    if (hash != NULL && (hashId = hllHashFromName(hash)) < 0) {
+        PyErr_Format(PyExc_ValueError, "Unknown hash '%s'.", hash);
+        return -1;
+    }
+
+    if (k < 2 || k > 16) {
+        char * msg = "Number of registers must be in the range [2^2, 2^16]";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    if (rows < 1 || rows > PY_SSIZE_T_MAX >> k) {
+        PyErr_SetString(PyExc_ValueError, "Number of rows out of range.");
+        return -1;
+    }
+
+    if (self->registers != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Already initialized.");
+        return -1;
+    }
+
+    self->k = k;
+    self->seed = seed;
+    self->hash = hashId;
+    self->size = 1 << k;
+    self->rows = rows;
+    self->registers = (char *) calloc(rows, self->size);
+    if (self->registers == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Gets integer i of a buffer of 1, 2, 4 or 8 byte integers. */
+static inline long long
+buffer_integer(const Py_buffer *view, Py_ssize_t i, int sign)
+{
+    switch (view->itemsize) {
+    case 1:
+        return sign ? ((const int8_t *) view->buf)[i]
+                    : ((const uint8_t *) view->buf)[i];
+    case 2:
+        return sign ? ((const int16_t *) view->buf)[i]
+                    : ((const uint16_t *) view->buf)[i];
+    case 4:
+        return sign ? (long long) ((const int32_t *) view->buf)[i]
+                    : (long long) ((const uint32_t *) view->buf)[i];
+    default:
+        return ((const int64_t *) view->buf)[i];
+    }
+}
+
+/* Gets the row numbers in rows, a buffer of integers such as a numpy array
+ * or a sequence of ints, and their number in count. Returns NULL with an
+ * exception set on failure. */
+static Py_ssize_t *
+read_rows(HyperLogLogArray *self, PyObject *rows, Py_ssize_t *count)
+{
+    Py_ssize_t *result, i, n;
+    Py_buffer view;
+    PyObject *seq;
+    const char *format;
+
+    if (PyObject_CheckBuffer(rows)) {
+        if (PyObject_GetBuffer(rows, &view,
+                               PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+            return NULL;
+
+        format = view.format ? view.format + strlen(view.format) - 1 : "B";
+        if ((view.itemsize != 1 && view.itemsize != 2 &&
+             view.itemsize != 4 && view.itemsize != 8) ||
+            strchr("bBhHiIlLqQnN", *format) == NULL) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "Rows must be integers.");
+            return NULL;
+        }
+
+        n = view.len / view.itemsize;
+        result = (Py_ssize_t *) malloc((n > 0 ? n : 1) * sizeof(Py_ssize_t));
+        if (result == NULL) {
+            PyBuffer_Release(&view);
+            return (Py_ssize_t *) PyErr_NoMemory();
+        }
+        for (i = 0; i < n; i++)
+            result[i] = (Py_ssize_t) buffer_integer(&view, i,
+                                                    islower(*format));
+        PyBuffer_Release(&view);
+    } else {
+        seq = PySequence_Fast(rows, "Rows must be integers.");
+        if (seq == NULL)
+            return NULL;
+
+        n = PySequence_Fast_GET_SIZE(seq);
+        result = (Py_ssize_t *) malloc((n > 0 ? n : 1) * sizeof(Py_ssize_t));
+        if (result == NULL) {
+            Py_DECREF(seq);
+            return (Py_ssize_t *) PyErr_NoMemory();
+        }
+        for (i = 0; i < n; i++) {
+            result[i] = PyNumber_AsSsize_t(PySequence_Fast_GET_ITEM(seq, i),
+                                           PyExc_IndexError);
+            if (result[i] == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                free(result);
+                return NULL;
+            }
+        }
+        Py_DECREF(seq);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (result[i] < 0 || result[i] >= self->rows) {
+            PyErr_SetString(PyExc_IndexError, "Row out of range.");
+            free(result);
+            return NULL;
+        }
+    }
+
+    *count = n;
+    return result;
+}
+
+/* Raises the register of a hash in a row to its rank. Large batches run
+ * without the GIL, so other threads may be raising the same register. */
+static inline void
+add_hash(HyperLogLogArray *self, Py_ssize_t row, uint32_t hash)
+{
+    char *reg = row_registers(self, row) + hllIndex(hash, self->k);
+    uint8_t rank = hllRank(hash, self->k);
+
+    if ((uint8_t) *reg < rank)
+        hllAtomicMax(reg, rank);
+}
+
+/* Adds keys[i] to row rows[i] for every i. Large batches are hashed and
+ * scattered to the rows without the GIL. */
+static PyObject *
+HyperLogLogArray_add(HyperLogLogArray *self, PyObject *args)
+{
+    PyObject *rowsArg, *keys, *seq;
+    Py_ssize_t *rows, i, n;
+    BatchItem *items;
+    PyThreadState *state = NULL;
+
+    if (!PyArg_ParseTuple(args, "OO", &rowsArg, &keys))
+        return NULL;
+
+    if ((rows = read_rows(self, rowsArg, &n)) == NULL)
+        return NULL;
+
+    /* A private list keeps every key alive while the GIL is released. */
+    seq = PySequence_List(keys);
+    if (seq == NULL) {
+        free(rows);
+        return NULL;
+    }
+
+    if (PySequence_Fast_GET_SIZE(seq) != n) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Rows and keys must have the same length.");
+        goto error;
+    }
+
+    items = (BatchItem *) malloc((n > 0 ? n : 1) * sizeof(BatchItem));
+    if (items == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+
+    for (i = 0; i < n; i++) {
+        const char *data;
+        Py_ssize_t dataLength;
+
+        if (!hllKeyData(PySequence_Fast_GET_ITEM(seq, i), &data,
+                        &dataLength)) {
+            free(items);
+            goto error;
+        }
+        items[i].data = data;
+        items[i].length = dataLength;
+    }
+
+    if (n >= HLL_NOGIL_SIZE)
+        state = PyEval_SaveThread();
+
+    for (i = 0; i < n; i++)
+        add_hash(self, rows[i], hllHash(self->hash, items[i].data,
+                                        items[i].length, self->seed));
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    free(items);
+    free(rows);
+    Py_DECREF(seq);
+    Py_INCREF(Py_None);
+    return Py_None;
+
+error:
+    free(rows);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+/* Adds hashes[i] to row rows[i] for every i, from a buffer of 4 or 8 byte
+ * hashes as returned by HyperLogLog.hash_many(). */
+static PyObject *
+HyperLogLogArray_add_hashes(HyperLogLogArray *self, PyObject *args)
+{
+    PyObject *rowsArg, *hashes;
+    Py_ssize_t *rows, i, n;
+    PyThreadState *state = NULL;
+    Py_buffer view;
+    const char *format;
+
+    if (!PyArg_ParseTuple(args, "OO", &rowsArg, &hashes))
+        return NULL;
+
+    if (PyObject_GetBuffer(hashes, &view,
+                           PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+        return NULL;
+
+    format = view.format ? view.format + strlen(view.format) - 1 : "I";
+    if ((view.itemsize != 4 && view.itemsize != 8) ||
+        strchr("iIlLqQ", *format) == NULL) {
+        PyBuffer_Release(&view);
+        char * msg = "Hashes must be 4 or 8 byte integers.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    if (view.itemsize == 8 && self->hash == HLL_HASH_MURMUR3) {
+        PyBuffer_Release(&view);
+        char * msg = "Murmur3 hashes are 4 bytes wide.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    if ((rows = read_rows(self, rowsArg, &n)) == NULL) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    if (view.len / view.itemsize != n) {
+        free(rows);
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError,
+                        "Rows and hashes must have the same length.");
+        return NULL;
+    }
+
+    if (n >= HLL_NOGIL_SIZE)
+        state = PyEval_SaveThread();
+
+    /* 8 byte hashes contribute their high half. */
+    for (i = 0; i < n; i++) {
+        if (view.itemsize == 4)
+            add_hash(self, rows[i], ((const uint32_t *) view.buf)[i]);
+        else
+            add_hash(self, rows[i],
+                     (uint32_t) (((const uint64_t *) view.buf)[i] >> 32));
+    }
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    free(rows);
+    PyBuffer_Release(&view);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Parses an optional estimator name. Returns -1 with an exception set if
+ * the name is unknown. */
+static int
+parse_estimator(const char *name)
+{
+    int estimator;
+
+    if (name == NULL)
+        return HLL_ESTIMATOR_CORRECTED;
+
+    if ((estimator = hllEstimatorFromName(name)) < 0)
+        PyErr_Format(PyExc_ValueError, "Unknown estimator '%s'.", name);
+
+    return estimator;
+}
+
+/* Gets the row number of an int. Returns -1 with an exception set if it is
+ * out of range. */
+static Py_ssize_t
+parse_row(HyperLogLogArray *self, PyObject *arg)
+{
+    Py_ssize_t row = PyNumber_AsSsize_t(arg, PyExc_IndexError);
+
+    if (row == -1 && PyErr_Occurred())
+        return -1;
+
+    if (row < 0 || row >= self->rows) {
+        PyErr_SetString(PyExc_IndexError, "Row out of range.");
+        return -1;
+    }
+
+    return row;
+}
+
+/* Gets the cardinality of a row. */
+static PyObject *
+HyperLogLogArray_cardinality(HyperLogLogArray *self, PyObject *args,
+                             PyObject *kwds)
+{
+    static char *kwlist[] = {"row", "estimator", NULL};
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+    const char *name = NULL;
+    PyObject *rowArg;
+    Py_ssize_t row;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|s", kwlist,
+                                     &rowArg, &name))
+        return NULL;
+
+    if ((row = parse_row(self, rowArg)) < 0 ||
+        (estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    hllHistogram(row_registers(self, row), self->size, counts);
+    return Py_BuildValue("d", hllEstimate(counts, self->k, estimator));
+}
+
+/* Gets the cardinality of every row, in a buffer of doubles. Large arrays
+ * are estimated without the GIL. */
+static PyObject *
+HyperLogLogArray_cardinalities(HyperLogLogArray *self, PyObject *args,
+                               PyObject *kwds)
+{
+    static char *kwlist[] = {"estimator", NULL};
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+    const char *name = NULL;
+    PyThreadState *state = NULL;
+    EstimateBuffer *result;
+    double *estimates;
+    Py_ssize_t i;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &name))
+        return NULL;
+
+    if ((estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    if ((result = hllEstimateBufferNew(self->rows)) == NULL)
+        return NULL;
+    estimates = result->estimates;
+
+    if ((uint64_t) self->rows * self->size >= HLL_NOGIL_SIZE)
+        state = PyEval_SaveThread();
+
+    for (i = 0; i < self->rows; i++) {
+        hllHistogram(row_registers(self, i), self->size, counts);
+        estimates[i] = hllEstimate(counts, self->k, estimator);
+    }
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    return (PyObject *) result;
+}
+
+/* Gets a HyperLogLog with a copy of a row. */
+static PyObject *
+HyperLogLogArray_get(HyperLogLogArray *self, PyObject *arg)
+{
+    HyperLogLog *hll;
+    Py_ssize_t row;
+
+    if ((row = parse_row(self, arg)) < 0)
+        return NULL;
+
+    hll = (HyperLogLog *) PyObject_CallFunction((PyObject *) &HyperLogLogType,
+                                                "iIis", self->k, self->seed,
+                                                HLL_THREADSAFE_DEFAULT,
+                                                hllHashName(self->hash));
+    if (hll == NULL)
+        return NULL;
+
+    if (hllOwnRegisters(hll) < 0) {
+        Py_DECREF(hll);
+        return NULL;
+    }
+
+    memcpy(hll->registers, row_registers(self, row), self->size);
+    return (PyObject *) hll;
+}
+
+/* Merges every row of another HyperLogLogArray into the same row of this
+ * one. The merge is atomic per register, as adds may run concurrently. */
+static PyObject *
+HyperLogLogArray_merge(HyperLogLogArray *self, PyObject *arg)
+{
+    HyperLogLogArray *other = (HyperLogLogArray *) arg;
+    PyThreadState *state = NULL;
+    size_t total, offset, block;
+
+    if (!PyObject_TypeCheck(arg, &HyperLogLogArrayType)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a HyperLogLogArray.");
+        return NULL;
+    }
+
+    if (other->k != self->k || other->rows != self->rows) {
+        char * msg = "HyperLogLogArrays must have the same shape.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    if (other->seed != self->seed || other->hash != self->hash) {
+        char * msg = "HyperLogLogArrays must use the same hash and seed.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    total = (size_t) self->rows * self->size;
+    if (total >= HLL_NOGIL_SIZE)
+        state = PyEval_SaveThread();
+
+    for (offset = 0; offset < total; offset += block) {
+        block = total - offset < HLL_ARRAY_MERGE_BLOCK
+            ? total - offset : HLL_ARRAY_MERGE_BLOCK;
+        hllMergeAtomic(self->registers + offset, other->registers + offset,
+                       (uint32_t) block);
+    }
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Gets a HyperLogLog with the union of some rows, or of all of them. */
+static PyObject *
+HyperLogLogArray_merged(HyperLogLogArray *self, PyObject *args,
+                        PyObject *kwds)
+{
+    static char *kwlist[] = {"rows", NULL};
+    PyObject *rowsArg = Py_None;
+    Py_ssize_t *rows = NULL, i, n = self->rows;
+    const char **others;
+    HyperLogLog *hll;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &rowsArg))
+        return NULL;
+
+    if (rowsArg != Py_None && (rows = read_rows(self, rowsArg, &n)) == NULL)
+        return NULL;
+
+    others = (const char **) malloc((n > 0 ? n : 1) * sizeof(char *));
+    if (others == NULL) {
+        free(rows);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < n; i++)
+        others[i] = row_registers(self, rows != NULL ? rows[i] : i);
+    free(rows);
+
+    hll = (HyperLogLog *) PyObject_CallFunction((PyObject *) &HyperLogLogType,
+                                                "iIis", self->k, self->seed,
+                                                HLL_THREADSAFE_DEFAULT,
+                                                hllHashName(self->hash));
+    if (hll == NULL || hllOwnRegisters(hll) < 0) {
+        Py_XDECREF(hll);
+        free(others);
+        return NULL;
+    }
+
+    if (n > 0)
+        hllMergeMany(hll->registers, others, n, self->size, 1);
+    free(others);
+
+    return (PyObject *) hll;
+}
+
+/* Gets the name of the hash function. */
+static PyObject *
+HyperLogLogArray_hash(HyperLogLogArray *self)
+{
+    #if PY_MAJOR_VERSION >= 3
+    return PyUnicode_FromString(hllHashName(self->hash));
+    #else
+    return PyString_FromString(hllHashName(self->hash));
+    #endif
+}
+
+/* Gets the seed value used in the hash. */
+static PyObject *
+HyperLogLogArray_seed(HyperLogLogArray *self)
+{
+    return Py_BuildValue("I", self->seed);
+}
+
+/* Gets the number of registers in each row. */
+static PyObject *
+HyperLogLogArray_size(HyperLogLogArray *self)
+{
+    return Py_BuildValue("I", self->size);
+}
+
+static Py_ssize_t
+HyperLogLogArray_length(HyperLogLogArray *self)
+{
+    return self->rows;
+}
+
+static PyMethodDef HyperLogLogArray_methods[] = {
+    {"add", (PyCFunction)HyperLogLogArray_add, METH_VARARGS,
+     "Add each element of keys to the row at the same position of rows."
+    },
+    {"add_hashes", (PyCFunction)HyperLogLogArray_add_hashes, METH_VARARGS,
+     "Add each hash of a buffer to the row at the same position of rows."
+    },
+    {"cardinalities", (PyCFunction)HyperLogLogArray_cardinalities,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get a buffer with the cardinality of every row."
+    },
+    {"cardinality", (PyCFunction)HyperLogLogArray_cardinality,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get the cardinality of a row."
+    },
+    {"get", (PyCFunction)HyperLogLogArray_get, METH_O,
+     "Get a HyperLogLog with a copy of a row."
+    },
+    {"hash", (PyCFunction)HyperLogLogArray_hash, METH_NOARGS,
+     "Get the name of the hash function."
+    },
+    {"merge", (PyCFunction)HyperLogLogArray_merge, METH_O,
+     "Merge every row of another HyperLogLogArray into this one."
+    },
+    {"merged", (PyCFunction)HyperLogLogArray_merged,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get a HyperLogLog with the union of some or all rows."
+    },
+    {"seed", (PyCFunction)HyperLogLogArray_seed, METH_NOARGS,
+     "Get the seed used in the hash."
+    },
+    {"size", (PyCFunction)HyperLogLogArray_size, METH_NOARGS,
+     "Returns the number of registers in each row."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods HyperLogLogArray_as_sequence = {
+    (lenfunc)HyperLogLogArray_length, /*sq_length*/
+};
+
+PyTypeObject HyperLogLogArrayType = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    #endif
+    "HLL.HyperLogLogArray",    /*tp_name*/
+    sizeof(HyperLogLogArray),  /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)HyperLogLogArray_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &HyperLogLogArray_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT |
+        Py_TPFLAGS_BASETYPE,   /*tp_flags*/
+    "HyperLogLogs numbered 0 to n - 1 in one block", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    HyperLogLogArray_methods,  /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)HyperLogLogArray_init, /* tp_init */
+    0,                         /* tp_alloc */
+    HyperLogLogArray_new,      /* tp_new */
+};
@@ -0,0 +1,178 @@
+#include "batch.h"
+#include "hash.h"
+#include "hll.h"
+#include "pool.h"
+#include "registers.h"
+#include <stdlib.h>
+
+/* A batch is added in three parallel phases. Each thread hashes a chunk of
+ * the elements and counts the hashes falling in each register range, then
+ * scatters its hashes into per-range buckets, and finally applies one bucket.
+ * The register ranges are disjoint, so the last phase needs no atomics unless
+ * other threads add to the same registers. */
+typedef struct Batch {
+    char *registers;
+    short int k;
+    int hash;
+    uint32_t seed;
+    const BatchItem *items;
+    size_t count;
+    int threads;
+    int atomic;
+    uint32_t *hashes;      /* hash of each element */
+    uint32_t *buckets;     /* hashes ordered by register range */
+    size_t *counts;        /* threads x threads hashes per chunk and range */
+    size_t *starts;        /* threads + 1 offsets of each range in buckets */
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    int id;
+} BatchTask;
+
+/* Gets the register range of a hash, ranges are contiguous and ordered. */
+static inline int
+hash_range(const Batch *batch, uint32_t hash)
+{
+    return (int) (((uint64_t) hllIndex(hash, batch->k) * batch->threads)
+                  >> batch->k);
+}
+
+static inline size_t
+chunk_start(const Batch *batch, int id)
+{
+    return (size_t) ((uint64_t) batch->count * id / batch->threads);
+}
+
+static void *
+hash_chunk(void *arg)
+{
+    BatchTask *task = (BatchTask *) arg;
+    Batch *batch = task->batch;
+    size_t *counts = batch->counts + (size_t) task->id * batch->threads;
+    size_t i, end = chunk_start(batch, task->id + 1);
+    uint32_t hash;
+
+    for (i = chunk_start(batch, task->id); i < end; i++) {
+        hash = hllHash(batch->hash, batch->items[i].data,
+                       batch->items[i].length, batch->seed);
+        batch->hashes[i] = hash;
+        counts[hash_range(batch, hash)]++;
+    }
+
+    return NULL;
+}
+
+static void *
+scatter_chunk(void *arg)
+{
+    BatchTask *task = (BatchTask *) arg;
+    Batch *batch = task->batch;
+    size_t offsets[batch->threads];
+    size_t i, end = chunk_start(batch, task->id + 1);
+    int r, c;
+
+    /* A chunk's hashes for range r follow those of earlier chunks. */
+    for (r = 0; r < batch->threads; r++) {
+        offsets[r] = batch->starts[r];
+        for (c = 0; c < task->id; c++)
+            offsets[r] += batch->counts[(size_t) c * batch->threads + r];
+    }
+
+    for (i = chunk_start(batch, task->id); i < end; i++) {
+        uint32_t hash = batch->hashes[i];
+        batch->buckets[offsets[hash_range(batch, hash)]++] = hash;
+    }
+
+    return NULL;
+}
+
+static void *
+apply_range(void *arg)
+{
+    BatchTask *task = (BatchTask *) arg;
+    Batch *batch = task->batch;
+    size_t i, end = batch->starts[task->id + 1];
+    short int k = batch->k;
+
+    for (i = batch->starts[task->id]; i < end; i++) {
+        uint32_t hash = batch->buckets[i];
+        char *reg = batch->registers + hllIndex(hash, k);
+        uint32_t rank = hllRank(hash, k);
+
+        if (batch->atomic)
+            hllAtomicMax(reg, rank);
+        else if ((uint8_t) *reg < rank)
+            *reg = rank;
+    }
+
+    return NULL;
+}
+
+/* Adds count elements to registers, hashing and applying them on up to
+ * threads threads. Set atomic when other threads may update the registers
+ * at the same time. */
+void hllAddBatch(char *registers, short int k, int hash, uint32_t seed,
+                 const BatchItem *items, size_t count, int threads,
+                 int atomic)
+{
+    Batch batch = {registers, k, hash, seed, items, count, threads, atomic};
+    BatchTask *tasks = NULL;
+    size_t i;
+    int r, c;
+
+    if (threads > HLL_BATCH_MAX_THREADS)
+        threads = HLL_BATCH_MAX_THREADS;
+    if ((size_t) threads > count / HLL_BATCH_MIN_PER_THREAD)
+        threads = (int) (count / HLL_BATCH_MIN_PER_THREAD);
+    if (threads > (1 << k))
+        threads = 1 << k;
+
+    if (threads > 1) {
+        batch.threads = threads;
+        batch.hashes = (uint32_t *) malloc(count * sizeof(uint32_t));
+        batch.buckets = (uint32_t *) malloc(count * sizeof(uint32_t));
+        batch.counts = (size_t *) calloc((size_t) threads * threads,
+                                         sizeof(size_t));
+        batch.starts = (size_t *) malloc((threads + 1) * sizeof(size_t));
+        tasks = (BatchTask *) malloc(threads * sizeof(BatchTask));
+    }
+
+    if (threads <= 1 || batch.hashes == NULL || batch.buckets == NULL ||
+        batch.counts == NULL || batch.starts == NULL || tasks == NULL) {
+        for (i = 0; i < count; i++) {
+            uint32_t value = hllHash(hash, items[i].data, items[i].length,
+                                     seed);
+            char *reg = registers + hllIndex(value, k);
+            uint32_t rank = hllRank(value, k);
+
+            if (atomic)
+                hllAtomicMax(reg, rank);
+            else if ((uint8_t) *reg < rank)
+                *reg = rank;
+        }
+    } else {
+        for (r = 0; r < threads; r++) {
+            tasks[r].batch = &batch;
+            tasks[r].id = r;
+        }
+
+        hllRunTasks(hash_chunk, tasks, sizeof(BatchTask), threads);
+
+        batch.starts[0] = 0;
+        for (r = 0; r < threads; r++) {
+            batch.starts[r + 1] = batch.starts[r];
+            for (c = 0; c < threads; c++)
+                batch.starts[r + 1] += batch.counts[(size_t) c * threads + r];
+        }
+
+        hllRunTasks(scatter_chunk, tasks, sizeof(BatchTask), threads);
+        hllRunTasks(apply_range, tasks, sizeof(BatchTask), threads);
+    }
+
+    free(batch.hashes);
+    free(batch.buckets);
+    free(batch.counts);
+    free(batch.starts);
+    free(tasks);
+}
@@ -0,0 +1,24 @@
+#ifndef _HLL_BATCH_H_
+#define _HLL_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Batches smaller than this many elements per thread are added on the
+ * calling thread. */
+#define HLL_BATCH_MIN_PER_THREAD 4096
+
+/* Batches are split across at most this many threads. */
+#define HLL_BATCH_MAX_THREADS 256
+
+/* An element of a batch, its bytes are hashed. */
+typedef struct {
+    const void *data;
+    size_t length;
+} BatchItem;
+
+void hllAddBatch(char *registers, short int k, int hash, uint32_t seed,
+                 const BatchItem *items, size_t count, int threads,
+                 int atomic);
+
+#endif // _HLL_BATCH_H_
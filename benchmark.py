@@ -0,0 +1,62 @@
+"""Times the per-call overhead of the single key methods, and the per-key
+cost of add_many() by key length for each hash.
+
+Run with: python benchmark.py
+"""
+from __future__ import print_function
+
+import timeit
+
+from HLL import HyperLogLog
+
+CALLS = 1000000
+REPEAT = 5
+
+# Keys per add_many() call and calls per timing of the key length sweep.
+SWEEP_KEYS = 100000
+SWEEP_CALLS = 10
+KEY_LENGTHS = [4, 8, 16, 32, 64, 256, 1024]
+HASHES = ['murmur3', 'xxh3', 'wyhash']
+
+SETUP = """
+from HLL import HyperLogLog, ShardedHyperLogLog
+hll = HyperLogLog(14, threadsafe=True)
+other = HyperLogLog(14, threadsafe=True)
+sharded = ShardedHyperLogLog(14)
+key = 'user:12345'
+"""
+
+CASES = [
+    ('add(str)', 'hll.add(key)'),
+    ('add(bytes)', "hll.add(b'user:12345')"),
+    ('ShardedHyperLogLog.add', 'sharded.add(key)'),
+    ('murmur3_hash', 'hll.murmur3_hash(key)'),
+    ('merge', 'hll.merge(other)'),
+]
+
+
+def sweep_key_lengths():
+    print('%-24s' % 'add_many ns/key' + ''.join('%10s' % h for h in HASHES))
+    for length in KEY_LENGTHS:
+        keys = [('%0*d' % (length, i))[-length:].encode('ascii')
+                for i in range(SWEEP_KEYS)]
+        row = []
+        for name in HASHES:
+            hll = HyperLogLog(14, hash=name)
+            times = timeit.repeat(lambda: hll.add_many(keys), repeat=REPEAT,
+                                  number=SWEEP_CALLS)
+            row.append(min(times) / (SWEEP_CALLS * SWEEP_KEYS) * 1e9)
+        print('%-24s' % ('%d byte keys' % length) +
+              ''.join('%10.1f' % ns for ns in row))
+
+
+def main():
+    for name, stmt in CASES:
+        times = timeit.repeat(stmt, SETUP, repeat=REPEAT, number=CALLS)
+        print('%-24s %6.1f ns/call' % (name, min(times) / CALLS * 1e9))
+    print()
+    sweep_key_lengths()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,559 @@
+#include "estimate.h"
+#include "registers.h"
+#include "const.h"
+#include <math.h>
+#include <string.h>
+
+/* Upper bound on the number of secant steps taken by the maximum-likelihood
+ * estimator. It typically converges within a handful. */
+#define MLE_MAX_ITERATIONS 32
+
+/* Upper bound on the number of Newton steps taken by the joint estimator,
+ * the step used for its finite differences and the log-likelihood gain below
+ * which it stops. */
+#define JOINT_MAX_ITERATIONS 100
+#define JOINT_DELTA 1e-4
+#define JOINT_TOLERANCE 1e-6
+
+typedef struct {
+    double distance;
+    uint32_t index;
+} Neighbour;
+
+/* Copies counts into hist, folding ranks above the largest possible rank,
+ * 32 - k + 1, into the last bin. Returns the largest possible rank. */
+static int
+fold_histogram(const uint32_t *counts, short int k, uint32_t *hist)
+{
+    int q = 32 - k;
+    int i;
+
+    memcpy(hist, counts, (q + 2) * sizeof(uint32_t));
+    for (i = q + 2; i < HLL_HISTOGRAM_SIZE; i++)
+        hist[q + 1] += counts[i];
+
+    return q + 1;
+}
+
+static double
+alpha(uint32_t m)
+{
+    switch (m) {
+      case 16:
+          return 0.673;
+      case 32:
+          return 0.697;
+      case 64:
+          return 0.709;
+      default:
+          return 0.7213/(1.0 + 1.079/(double) m);
+    }
+}
+
+/* Averages the bias of the KNN_COUNT empirical raw estimates closest to E. */
+static double
+estimate_bias(double E, short int k)
+{
+    Neighbour nearest[KNN_COUNT];
+    const double *raw_estimate_data = rawEstimateData[k - 4];
+    const double *bias_data = biasData[k - 4];
+    uint32_t n = arrayLengths[k - 4];
+    uint32_t i;
+    int found = 0, j;
+    double x, sum = 0.0;
+
+    /* Keep the KNN_COUNT smallest distances in ascending order. */
+    for (i = 0; i < n; i++) {
+        x = E - raw_estimate_data[i];
+        x = x * x;
+
+        if (found == KNN_COUNT && x >= nearest[KNN_COUNT - 1].distance)
+            continue;
+
+        j = found < KNN_COUNT ? found++ : KNN_COUNT - 1;
+        for (; j > 0 && nearest[j - 1].distance > x; j--)
+            nearest[j] = nearest[j - 1];
+        nearest[j].distance = x;
+        nearest[j].index = i;
+    }
+
+    for (j = 0; j < found; j++)
+        sum += bias_data[nearest[j].index];
+
+    return sum / KNN_COUNT;
+}
+
+/* Ertl's sigma function, "New cardinality estimation algorithms for
+ * HyperLogLog sketches", algorithm 6. */
+static double
+sigma(double x)
+{
+    double y = 1.0, z = x, zPrev;
+
+    if (x == 1.0)
+        return INFINITY;
+
+    do {
+        x *= x;
+        zPrev = z;
+        z += x * y;
+        y += y;
+    } while (z != zPrev);
+
+    return z;
+}
+
+/* Ertl's tau function, algorithm 6. */
+static double
+tau(double x)
+{
+    double y = 1.0, z = 1.0 - x, zPrev;
+
+    if (x == 0.0 || x == 1.0)
+        return 0.0;
+
+    do {
+        x = sqrt(x);
+        zPrev = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != zPrev);
+
+    return z / 3.0;
+}
+
+/* Maps an estimator name to its identifier, or -1 if the name is unknown. */
+int hllEstimatorFromName(const char *name)
+{
+    if (strcmp(name, "corrected") == 0)
+        return HLL_ESTIMATOR_CORRECTED;
+    if (strcmp(name, "raw") == 0)
+        return HLL_ESTIMATOR_RAW;
+    if (strcmp(name, "linear") == 0)
+        return HLL_ESTIMATOR_LINEAR;
+    if (strcmp(name, "improved") == 0)
+        return HLL_ESTIMATOR_IMPROVED;
+    if (strcmp(name, "mle") == 0)
+        return HLL_ESTIMATOR_MLE;
+    return -1;
+}
+
+double hllEstimate(const uint32_t *counts, short int k, int estimator)
+{
+    switch (estimator) {
+      case HLL_ESTIMATOR_RAW:
+          return hllRawEstimate(counts, k);
+      case HLL_ESTIMATOR_LINEAR:
+          return hllLinearCounting(counts, k);
+      case HLL_ESTIMATOR_IMPROVED:
+          return hllImprovedEstimate(counts, k);
+      case HLL_ESTIMATOR_MLE:
+          return hllMaxLikelihoodEstimate(counts, k);
+      default:
+          return hllCorrectedEstimate(counts, k);
+    }
+}
+
+/* The raw HyperLogLog estimate, alpha_m * m^2 / SUM(2^-register). */
+double hllRawEstimate(const uint32_t *counts, short int k)
+{
+    uint32_t hist[HLL_HISTOGRAM_SIZE];
+    uint32_t m = 1 << k;
+    int r, maxRank = fold_histogram(counts, k, hist);
+    double sum = 0.0;
+
+    for (r = maxRank; r >= 0; r--)
+        sum += ldexp((double) hist[r], -r);
+
+    return alpha(m) * m * m / sum;
+}
+
+/* Linear counting, m * log(m / V) where V is the number of empty registers.
+ * The estimate is infinite when no register is empty. */
+double hllLinearCounting(const uint32_t *counts, short int k)
+{
+    uint32_t m = 1 << k;
+
+    if (counts[0] == 0)
+        return INFINITY;
+
+    return m * log(m / (double) counts[0]);
+}
+
+/* Uses linear counting for small cardinalities and otherwise the raw
+ * estimate, corrected with the empirical bias from "HyperLogLog in Practice"
+ * when it is below 5m. Bias data is only available for k in [4, 18], other
+ * sizes fall back to the thresholds in the original HyperLogLog paper.
+ */
+double hllCorrectedEstimate(const uint32_t *counts, short int k)
+{
+    uint32_t m = 1 << k;
+    int tables = k >= 4 && k <= 18;
+    double E;
+
+    if (counts[0] > 0) {
+        E = hllLinearCounting(counts, k);
+        if (tables ? E <= tresholdData[k - 4] : E <= 2.5 * m)
+            return E;
+    }
+
+    E = hllRawEstimate(counts, k);
+    if (tables && E <= 5 * m)
+        E -= estimate_bias(E, k);
+
+    return E;
+}
+
+/* Ertl's improved raw estimator, which needs neither bias correction nor
+ * a switch to linear counting. */
+double hllImprovedEstimate(const uint32_t *counts, short int k)
+{
+    uint32_t hist[HLL_HISTOGRAM_SIZE];
+    uint32_t m = 1 << k;
+    int r, q = fold_histogram(counts, k, hist) - 1;
+    double z;
+
+    z = m * tau(1.0 - hist[q + 1] / (double) m);
+    for (r = q; r >= 1; r--) {
+        z += hist[r];
+        z *= 0.5;
+    }
+    z += m * sigma(hist[0] / (double) m);
+
+    return m / (2.0 * log(2.0)) * m / z;
+}
+
+/* Ertl's maximum-likelihood estimator, algorithm 8 of "New cardinality
+ * estimation algorithms for HyperLogLog sketches". The root of the
+ * derivative of the log-likelihood is found with the secant method, each
+ * step costs O(q) so the estimate is independent of the number of
+ * registers once the histogram is known.
+ */
+double hllMaxLikelihoodEstimate(const uint32_t *counts, short int k)
+{
+    uint32_t hist[HLL_HISTOGRAM_SIZE];
+    uint32_t m = 1 << k;
+    int q = fold_histogram(counts, k, hist) - 1;
+    int kMin, kMax, kappa, r, i;
+    double a, b, c, g, gPrev = 0.0, h, x, dx, xp, xpp, z = 0.0, mp;
+
+    if (hist[q + 1] == m)
+        return INFINITY;
+
+    for (kMin = 0; hist[kMin] == 0; kMin++);
+    for (kMax = q + 1; hist[kMax] == 0; kMax--);
+    kMin = kMin > 1 ? kMin : 1;
+    kMax = kMax < q ? kMax : q;
+
+    for (r = kMax; r >= kMin; r--)
+        z = 0.5 * z + hist[r];
+    z = ldexp(z, -kMin);
+
+    c = hist[q + 1];
+    if (q >= 1)
+        c += hist[kMax];
+
+    a = z + hist[0];
+    b = z + ldexp((double) hist[q + 1], -q);
+    mp = m - hist[0];
+
+    if (b <= 1.5 * a)
+        x = mp / (0.5 * b + a);
+    else
+        x = mp / b * log1p(b / a);
+
+    dx = x;
+    for (i = 0; i < MLE_MAX_ITERATIONS && dx > x * 1e-2 / sqrt(m); i++) {
+        frexp(x, &kappa);
+        kappa += 1;
+
+        xp = ldexp(x, -(kMax > kappa ? kMax : kappa) - 1);
+        xpp = xp * xp;
+        h = xp - xpp / 3.0 + xpp * xpp * (1.0 / 45.0 - xpp / 472.5);
+
+        for (r = kappa - 1; r >= kMax; r--) {
+            h = (xp + h * (1.0 - h)) / (xp + (1.0 - h));
+            xp += xp;
+        }
+
+        g = c * h;
+        for (r = kMax - 1; r >= kMin; r--) {
+            h = (xp + h * (1.0 - h)) / (xp + (1.0 - h));
+            g += hist[r] * h;
+            xp += xp;
+        }
+        g += x * a;
+
+        if (g > gPrev && mp >= g)
+            dx *= (mp - g) / (g - gPrev);
+        else
+            dx = 0.0;
+
+        x += dx;
+        gPrev = g;
+    }
+
+    return m * x;
+}
+
+/* Log-probability that a register holds rank r after lambda distinct
+ * elements were added to a sketch with m registers. */
+static double
+log_rank(double lambda, int r, int q, uint32_t m)
+{
+    double t;
+
+    if (r == 0)
+        return -lambda / m;
+
+    t = ldexp(lambda / m, -(r <= q ? r : q));
+    return r <= q ? log(-expm1(-t)) - t : log(-expm1(-t));
+}
+
+/* Log-probability that both registers hold rank r when a elements were only
+ * added to the first sketch, b only to the second and x to both. */
+static double
+log_equal(double a, double b, double x, int r, int q, uint32_t m)
+{
+    double s, ta, tb, tx, p;
+
+    if (r == 0)
+        return -(a + b + x) / m;
+
+    s = ldexp(1.0 / m, -(r <= q ? r : q));
+    ta = a * s;
+    tb = b * s;
+    tx = x * s;
+
+    /* 1 - e^-(ta + tx) - e^-(tb + tx) + e^-(ta + tb + tx) */
+    p = -expm1(-ta - tx) + exp(-tb - tx) * expm1(-ta);
+    if (p <= 0.0)
+        return -INFINITY;
+
+    return r <= q ? log(p) - (ta + tb + tx) : log(p);
+}
+
+/* Log-likelihood of the folded joint histogram given the logarithms of the
+ * three cardinalities |A \ B|, |B \ A| and |A & B|. */
+static double
+joint_log_likelihood(const JointHistogram *joint, int q, uint32_t m,
+                     const double *u)
+{
+    double a = exp(u[0]), b = exp(u[1]), x = exp(u[2]);
+    double ll = 0.0;
+    int r;
+
+    for (r = 0; r <= q + 1; r++) {
+        if (joint->less1[r])
+            ll += joint->less1[r] * log_rank(a + x, r, q, m);
+        if (joint->less2[r])
+            ll += joint->less2[r] * log_rank(b, r, q, m);
+        if (joint->greater1[r])
+            ll += joint->greater1[r] * log_rank(a, r, q, m);
+        if (joint->greater2[r])
+            ll += joint->greater2[r] * log_rank(b + x, r, q, m);
+        if (joint->equal[r])
+            ll += joint->equal[r] * log_equal(a, b, x, r, q, m);
+    }
+
+    return ll;
+}
+
+/* Solves the 3x3 system A d = g for a symmetric positive definite A with a
+ * Cholesky decomposition. Returns 0 if A is not positive definite. */
+static int
+solve3(double A[3][3], const double *g, double *d)
+{
+    double L[3][3] = {{0}}, y[3], sum;
+    int i, j, l;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j <= i; j++) {
+            sum = A[i][j];
+            for (l = 0; l < j; l++)
+                sum -= L[i][l] * L[j][l];
+            if (i == j) {
+                if (!(sum > 0.0))
+                    return 0;
+                L[i][i] = sqrt(sum);
+            } else {
+                L[i][j] = sum / L[j][j];
+            }
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        sum = g[i];
+        for (l = 0; l < i; l++)
+            sum -= L[i][l] * y[l];
+        y[i] = sum / L[i][i];
+    }
+    for (i = 2; i >= 0; i--) {
+        sum = y[i];
+        for (l = i + 1; l < 3; l++)
+            sum -= L[l][i] * d[l];
+        d[i] = sum / L[i][i];
+    }
+
+    return 1;
+}
+
+/* Ertl's joint maximum-likelihood estimation of |A \ B|, |B \ A| and |A & B|
+ * from the register pairs of two sketches, section 7 of "New cardinality
+ * estimation algorithms for HyperLogLog sketches". estimates receives the
+ * three cardinalities in that order.
+ *
+ * The likelihood is maximized over the logarithms of the cardinalities with
+ * Newton's method using finite differences, starting from the inclusion-
+ * exclusion estimates. Steps fall back to gradient ascent where the Hessian
+ * is not negative definite, and are halved until the likelihood improves.
+ */
+void hllJointEstimate(const JointHistogram *joint, short int k,
+                      double *estimates)
+{
+    JointHistogram folded;
+    uint32_t a[HLL_HISTOGRAM_SIZE], b[HLL_HISTOGRAM_SIZE];
+    uint32_t u[HLL_HISTOGRAM_SIZE];
+    uint32_t m = 1 << k;
+    double x[3], ea, eb, eu, ll, best, gain;
+    int q, r, i, j, iteration;
+
+    q = fold_histogram(joint->less1, k, folded.less1) - 1;
+    fold_histogram(joint->less2, k, folded.less2);
+    fold_histogram(joint->greater1, k, folded.greater1);
+    fold_histogram(joint->greater2, k, folded.greater2);
+    fold_histogram(joint->equal, k, folded.equal);
+
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    memset(u, 0, sizeof(u));
+    for (r = 0; r <= q + 1; r++) {
+        a[r] = folded.less1[r] + folded.greater1[r] + folded.equal[r];
+        b[r] = folded.less2[r] + folded.greater2[r] + folded.equal[r];
+        u[r] = folded.less2[r] + folded.greater1[r] + folded.equal[r];
+    }
+
+    ea = hllMaxLikelihoodEstimate(a, k);
+    eb = hllMaxLikelihoodEstimate(b, k);
+    eu = hllMaxLikelihoodEstimate(u, k);
+
+    estimates[0] = eu - eb > 0.0 ? eu - eb : 0.0;
+    estimates[1] = eu - ea > 0.0 ? eu - ea : 0.0;
+    estimates[2] = ea + eb - eu > 0.0 ? ea + eb - eu : 0.0;
+
+    if (u[0] == m || isinf(eu))
+        return;
+
+    for (i = 0; i < 3; i++)
+        x[i] = log(estimates[i] > 1.0 ? estimates[i] : 1.0);
+    best = joint_log_likelihood(&folded, q, m, x);
+
+    for (iteration = 0; iteration < JOINT_MAX_ITERATIONS; iteration++) {
+        double g[3], H[3][3], d[3], y[3], fp[3], fm[3], norm = 0.0, step;
+        const double h = JOINT_DELTA;
+
+        for (i = 0; i < 3; i++) {
+            memcpy(y, x, sizeof(y));
+            y[i] = x[i] + h;
+            fp[i] = joint_log_likelihood(&folded, q, m, y);
+            y[i] = x[i] - h;
+            fm[i] = joint_log_likelihood(&folded, q, m, y);
+            g[i] = (fp[i] - fm[i]) / (2 * h);
+            H[i][i] = -(fp[i] - 2 * best + fm[i]) / (h * h);
+        }
+
+        for (i = 0; i < 3; i++) {
+            for (j = i + 1; j < 3; j++) {
+                double fpp, fpm, fmp, fmm;
+                memcpy(y, x, sizeof(y));
+                y[i] = x[i] + h; y[j] = x[j] + h;
+                fpp = joint_log_likelihood(&folded, q, m, y);
+                y[j] = x[j] - h;
+                fpm = joint_log_likelihood(&folded, q, m, y);
+                y[i] = x[i] - h;
+                fmm = joint_log_likelihood(&folded, q, m, y);
+                y[j] = x[j] + h;
+                fmp = joint_log_likelihood(&folded, q, m, y);
+                H[i][j] = H[j][i] = -(fpp - fpm - fmp + fmm) / (4 * h * h);
+            }
+        }
+
+        /* H holds the negated Hessian, so the Newton step solves H d = g. */
+        if (!solve3(H, g, d)) {
+            for (i = 0; i < 3; i++)
+                norm = fabs(g[i]) > norm ? fabs(g[i]) : norm;
+            if (!(norm > 0.0))
+                break;
+            for (i = 0; i < 3; i++)
+                d[i] = g[i] / norm;
+        }
+
+        for (step = 1.0; step > 1e-10; step *= 0.5) {
+            for (i = 0; i < 3; i++)
+                y[i] = x[i] + step * d[i];
+            ll = joint_log_likelihood(&folded, q, m, y);
+            if (ll > best)
+                break;
+        }
+        if (!(step > 1e-10))
+            break;
+
+        memcpy(x, y, sizeof(x));
+        gain = ll - best;
+        best = ll;
+
+        norm = 0.0;
+        for (i = 0; i < 3; i++)
+            norm = fabs(step * d[i]) > norm ? fabs(step * d[i]) : norm;
+        if (norm < 1e-9 || gain < JOINT_TOLERANCE)
+            break;
+    }
+
+    for (i = 0; i < 3; i++)
+        estimates[i] = exp(x[i]);
+}
+
+/* Gets the standard error of an estimate computed from counts.
+ *
+ * Linear counting has variance m(e^t - t - 1) where t = n/m [Whang et al.],
+ * it is used when the estimator is linear counting or when the corrected
+ * estimator switched to linear counting. Otherwise the relative standard
+ * error of the HyperLogLog estimators is 1.04/sqrt(m).
+ */
+double hllStandardError(const uint32_t *counts, short int k, int estimator,
+                        double estimate)
+{
+    uint32_t m = 1 << k;
+    int linear = estimator == HLL_ESTIMATOR_LINEAR;
+
+    if (estimator == HLL_ESTIMATOR_CORRECTED && counts[0] > 0)
+        linear = estimate == hllLinearCounting(counts, k);
+
+    if (isinf(estimate))
+        return INFINITY;
+
+    if (linear) {
+        double t = estimate / m;
+        return sqrt(m * (expm1(t) - t));
+    }
+
+    return 1.04 / sqrt(m) * estimate;
+}
+
+/* Gets z such that a standard normal variable lies in [-z, z] with the given
+ * probability, by bisection on erf. */
+double hllNormalQuantile(double confidence)
+{
+    double lo = 0.0, hi = 40.0, mid;
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        mid = 0.5 * (lo + hi);
+        if (erf(mid / sqrt(2.0)) < confidence)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return 0.5 * (lo + hi);
+}
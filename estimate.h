@@ -0,0 +1,38 @@
+#ifndef _HLL_ESTIMATE_H_
+#define _HLL_ESTIMATE_H_
+
+#include <stdint.h>
+#include "registers.h"
+
+/* Estimators computed from a register histogram, see hllHistogram(). */
+enum {
+    HLL_ESTIMATOR_CORRECTED, /* linear counting or bias corrected raw */
+    HLL_ESTIMATOR_RAW,       /* HyperLogLog raw estimate */
+    HLL_ESTIMATOR_LINEAR,    /* linear counting */
+    HLL_ESTIMATOR_IMPROVED,  /* Ertl's improved raw estimator */
+    HLL_ESTIMATOR_MLE        /* Ertl's maximum-likelihood estimator */
+};
+
+int hllEstimatorFromName(const char *name);
+
+double hllEstimate(const uint32_t *counts, short int k, int estimator);
+
+double hllCorrectedEstimate(const uint32_t *counts, short int k);
+
+double hllRawEstimate(const uint32_t *counts, short int k);
+
+double hllLinearCounting(const uint32_t *counts, short int k);
+
+double hllImprovedEstimate(const uint32_t *counts, short int k);
+
+double hllMaxLikelihoodEstimate(const uint32_t *counts, short int k);
+
+void hllJointEstimate(const JointHistogram *joint, short int k,
+                      double *estimates);
+
+double hllStandardError(const uint32_t *counts, short int k, int estimator,
+                        double estimate);
+
+double hllNormalQuantile(double confidence);
+
+#endif // _HLL_ESTIMATE_H_
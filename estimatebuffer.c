@@ -0,0 +1,126 @@
+#include "hll.h"
+#include <stdlib.h>
+
+#if PY_MAJOR_VERSION >= 3
+#define HLL_TPFLAGS_HAVE_NEWBUFFER 0
+#else
+#define HLL_TPFLAGS_HAVE_NEWBUFFER Py_TPFLAGS_HAVE_NEWBUFFER
+#endif
+
+/* Bytes per estimate, exported as the stride of the buffer. */
+static Py_ssize_t estimateWidth = sizeof(double);
+
+/* Creates an uninitialized buffer of count estimates. */
+EstimateBuffer *
+hllEstimateBufferNew(Py_ssize_t count)
+{
+    EstimateBuffer *self = PyObject_New(EstimateBuffer, &EstimateBufferType);
+
+    if (self == NULL)
+        return NULL;
+
+    self->count = count;
+    self->estimates = (double *) malloc(count > 0 ? count * sizeof(double)
+                                                  : 1);
+    if (self->estimates == NULL) {
+        Py_DECREF(self);
+        return (EstimateBuffer *) PyErr_NoMemory();
+    }
+
+    return self;
+}
+
+static void
+EstimateBuffer_dealloc(EstimateBuffer *self)
+{
+    free(self->estimates);
+    PyObject_Del(self);
+}
+
+static Py_ssize_t
+EstimateBuffer_length(EstimateBuffer *self)
+{
+    return self->count;
+}
+
+static PyObject *
+EstimateBuffer_item(EstimateBuffer *self, Py_ssize_t i)
+{
+    if (i < 0 || i >= self->count) {
+        PyErr_SetString(PyExc_IndexError, "Index out of range.");
+        return NULL;
+    }
+
+    return PyFloat_FromDouble(self->estimates[i]);
+}
+
+/* Exports the estimates as a one dimensional array of doubles, the format
+ * numpy and memoryview expect. */
+static int
+EstimateBuffer_getbuffer(EstimateBuffer *self, Py_buffer *view, int flags)
+{
+    view->obj = (PyObject *) self;
+    Py_INCREF(self);
+    view->buf = self->estimates;
+    view->len = self->count * estimateWidth;
+    view->readonly = 0;
+    view->itemsize = estimateWidth;
+    view->format = NULL;
+    if (flags & PyBUF_FORMAT)
+        view->format = "d";
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->count : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &estimateWidth : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    return 0;
+}
+
+static PySequenceMethods EstimateBuffer_as_sequence = {
+    (lenfunc)EstimateBuffer_length,     /*sq_length*/
+    0,                                  /*sq_concat*/
+    0,                                  /*sq_repeat*/
+    (ssizeargfunc)EstimateBuffer_item,  /*sq_item*/
+};
+
+static PyBufferProcs EstimateBuffer_as_buffer = {
+    #if PY_MAJOR_VERSION < 3
+    0,                                  /*bf_getreadbuffer*/
+    0,                                  /*bf_getwritebuffer*/
+    0,                                  /*bf_getsegcount*/
+    0,                                  /*bf_getcharbuffer*/
+    #endif
+    (getbufferproc)EstimateBuffer_getbuffer, /*bf_getbuffer*/
+    0,                                  /*bf_releasebuffer*/
+};
+
+PyTypeObject EstimateBufferType = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    #endif
+    "HLL.EstimateBuffer",      /*tp_name*/
+    sizeof(EstimateBuffer),    /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)EstimateBuffer_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &EstimateBuffer_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &EstimateBuffer_as_buffer, /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT |
+        HLL_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "Cardinality estimates in a contiguous buffer", /* tp_doc */
+};
@@ -0,0 +1,212 @@
+#include "explicit.h"
+#include "hll.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Tables start with this many slots and double as they fill up. */
+#define HLL_EXPLICIT_MIN_CAPACITY 16
+
+/* Gets the most distinct hashes a HyperLogLog with 2^k registers keeps
+ * explicitly. The table then has as many bytes as the registers and is three
+ * quarters full. Returns 0 if the registers are too few to bother. */
+uint32_t
+hllExplicitLimit(short int k)
+{
+    uint32_t capacity = ((uint32_t) 1 << k) / sizeof(uint32_t);
+
+    return capacity / 4 * 3;
+}
+
+/* Creates an empty set that holds up to limit hashes. Returns
+ * HLL_EXPLICIT_NOMEM on failure. */
+int
+hllExplicitInit(ExplicitSet *set, uint32_t limit)
+{
+    set->capacity = HLL_EXPLICIT_MIN_CAPACITY;
+    while (set->capacity > 4 && set->capacity / 4 * 3 > limit)
+        set->capacity /= 2;
+
+    set->count = 0;
+    set->limit = limit;
+    set->zero = 0;
+    set->slots = (uint32_t *) calloc(set->capacity, sizeof(uint32_t));
+    if (set->slots == NULL) {
+        set->capacity = 0;
+        return HLL_EXPLICIT_NOMEM;
+    }
+
+    return 0;
+}
+
+/* Gets the slot holding hash, or the empty slot it would go in. */
+static inline uint32_t *
+find_slot(const ExplicitSet *set, uint32_t hash)
+{
+    uint32_t mask = set->capacity - 1;
+    uint32_t i = hash & mask;
+
+    while (set->slots[i] != 0 && set->slots[i] != hash)
+        i = (i + 1) & mask;
+
+    return &set->slots[i];
+}
+
+/* Doubles the number of slots, rehashing every hash. */
+static int
+grow(ExplicitSet *set)
+{
+    ExplicitSet bigger = *set;
+    uint32_t i;
+
+    bigger.capacity = set->capacity * 2;
+    bigger.slots = (uint32_t *) calloc(bigger.capacity, sizeof(uint32_t));
+    if (bigger.slots == NULL)
+        return HLL_EXPLICIT_NOMEM;
+
+    for (i = 0; i < set->capacity; i++) {
+        if (set->slots[i] != 0)
+            *find_slot(&bigger, set->slots[i]) = set->slots[i];
+    }
+
+    free(set->slots);
+    *set = bigger;
+    return 0;
+}
+
+/* Adds a hash to the set. Returns 1 if the hash is new, 0 if it was already
+ * there, or HLL_EXPLICIT_FULL or HLL_EXPLICIT_NOMEM if it couldn't be added.
+ */
+int
+hllExplicitAdd(ExplicitSet *set, uint32_t hash)
+{
+    uint32_t *slot;
+
+    if (hash == 0) {
+        if (set->zero)
+            return 0;
+        if (set->count >= set->limit)
+            return HLL_EXPLICIT_FULL;
+        set->zero = 1;
+        set->count++;
+        return 1;
+    }
+
+    slot = find_slot(set, hash);
+    if (*slot == hash)
+        return 0;
+
+    if (set->count >= set->limit)
+        return HLL_EXPLICIT_FULL;
+
+    /* Keep the table at most three quarters full. */
+    if ((set->count + 1) * 4 > set->capacity * 3) {
+        if (grow(set) < 0)
+            return HLL_EXPLICIT_NOMEM;
+        slot = find_slot(set, hash);
+    }
+
+    *slot = hash;
+    set->count++;
+    return 1;
+}
+
+/* Adds every hash of other to the set. Returns 0, or HLL_EXPLICIT_FULL or
+ * HLL_EXPLICIT_NOMEM if some hashes couldn't be added. */
+int
+hllExplicitMerge(ExplicitSet *set, const ExplicitSet *other)
+{
+    uint32_t i;
+    int status;
+
+    if (other->zero && (status = hllExplicitAdd(set, 0)) < 0)
+        return status;
+
+    for (i = 0; i < other->capacity; i++) {
+        if (other->slots[i] != 0 &&
+            (status = hllExplicitAdd(set, other->slots[i])) < 0)
+            return status;
+    }
+
+    return 0;
+}
+
+/* Makes set a copy of other. Returns HLL_EXPLICIT_NOMEM on failure. */
+int
+hllExplicitCopy(ExplicitSet *set, const ExplicitSet *other)
+{
+    *set = *other;
+    set->slots = (uint32_t *) malloc(other->capacity * sizeof(uint32_t));
+    if (set->slots == NULL) {
+        set->capacity = 0;
+        return HLL_EXPLICIT_NOMEM;
+    }
+    memcpy(set->slots, other->slots, other->capacity * sizeof(uint32_t));
+
+    return 0;
+}
+
+static inline char *
+encode_hash(char *out, uint32_t hash)
+{
+    out[0] = (char) (hash & 0xFF);
+    out[1] = (char) (hash >> 8 & 0xFF);
+    out[2] = (char) (hash >> 16 & 0xFF);
+    out[3] = (char) (hash >> 24);
+    return out + 4;
+}
+
+/* Serializes the set as HLL_EXPLICIT_BYTE followed by every hash in 4 little
+ * endian bytes. out must have room for 1 + 4 * count bytes. Returns the
+ * number of bytes written. */
+size_t
+hllExplicitEncode(const ExplicitSet *set, char *out)
+{
+    char *end = out;
+    uint32_t i;
+
+    *end++ = HLL_EXPLICIT_BYTE;
+    if (set->zero)
+        end = encode_hash(end, 0);
+
+    for (i = 0; i < set->capacity; i++) {
+        if (set->slots[i] != 0)
+            end = encode_hash(end, set->slots[i]);
+    }
+
+    return end - out;
+}
+
+/* Raises the register of a hash to its rank. */
+static inline void
+raise_register(char *registers, short int k, uint32_t hash)
+{
+    uint32_t index = hllIndex(hash, k), rank = hllRank(hash, k);
+
+    if ((uint8_t) registers[index] < rank)
+        registers[index] = rank;
+}
+
+/* Raises 2^k registers to the ranks of the hashes in the set. */
+void
+hllExplicitRegisters(const ExplicitSet *set, char *registers, short int k)
+{
+    uint32_t i;
+
+    if (set->zero)
+        raise_register(registers, k, 0);
+
+    for (i = 0; i < set->capacity; i++) {
+        if (set->slots[i] != 0)
+            raise_register(registers, k, set->slots[i]);
+    }
+}
+
+void
+hllExplicitFree(ExplicitSet *set)
+{
+    free(set->slots);
+    set->slots = NULL;
+    set->capacity = 0;
+    set->count = 0;
+    set->zero = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef _HLL_EXPLICIT_H_
+#define _HLL_EXPLICIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by hllExplicitAdd() and hllExplicitMerge() when the set already
+ * holds its limit of hashes. */
+#define HLL_EXPLICIT_FULL -1
+
+/* Returned by hllExplicitAdd() and hllExplicitMerge() when the table can't
+ * grow. */
+#define HLL_EXPLICIT_NOMEM -2
+
+/* Starts an explicit set serialized by hllExplicitEncode(). Registers never
+ * hold a rank this large, so serialized registers can't start with it. */
+#define HLL_EXPLICIT_BYTE 'e'
+
+/* The distinct hashes added to a small HyperLogLog, in an open addressing
+ * table with linear probing. An empty slot holds 0, so whether the hash 0 was
+ * added is kept in zero instead. */
+typedef struct {
+    uint32_t *slots;
+    uint32_t capacity; /* number of slots, a power of 2 */
+    uint32_t count;    /* number of distinct hashes, including 0 */
+    uint32_t limit;    /* most hashes held before converting to registers */
+    int zero;          /* the hash 0 was added */
+} ExplicitSet;
+
+uint32_t hllExplicitLimit(short int k);
+
+int hllExplicitInit(ExplicitSet *set, uint32_t limit);
+
+int hllExplicitAdd(ExplicitSet *set, uint32_t hash);
+
+int hllExplicitMerge(ExplicitSet *set, const ExplicitSet *other);
+
+int hllExplicitCopy(ExplicitSet *set, const ExplicitSet *other);
+
+size_t hllExplicitEncode(const ExplicitSet *set, char *out);
+
+/* Reads a hash serialized by hllExplicitEncode(). */
+static inline uint32_t
+hllExplicitDecode(const char *in)
+{
+    const unsigned char *p = (const unsigned char *) in;
+
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+           (uint32_t) p[3] << 24;
+}
+
+void hllExplicitRegisters(const ExplicitSet *set, char *registers,
+                          short int k);
+
+void hllExplicitFree(ExplicitSet *set);
+
+#endif // _HLL_EXPLICIT_H_
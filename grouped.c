@@ -0,0 +1,806 @@
+#include "hll.h"
+#include "estimate.h"
+#include "hash.h"
+#include "registers.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* The group table starts with this many slots and doubles as it fills up. */
+#define HLL_GROUPS_MIN_CAPACITY 16
+
+/* A group owns a copy of its key and counts its elements exactly in an
+ * explicit set until the set would take more memory than the registers. */
+typedef struct {
+    uint64_t keyHash;   /* hash of the key in the group table */
+    char *key;          /* bytes of the group key */
+    Py_ssize_t keyLength;
+    char *registers;    /* ranks, NULL if explicit */
+    ExplicitSet small;  /* distinct hashes while there are no registers */
+} Group;
+
+/* Groups are kept in the order they were created. The table maps a key to
+ * its group with linear probing, a slot holds the index of the group plus
+ * one, or 0 if it is empty. */
+typedef struct {
+    PyObject_HEAD
+    short int k;        /* size = 2^k */
+    uint32_t seed;      /* hash seed */
+    int hash;           /* hash function, see hash.h */
+    uint32_t size;      /* number of registers per group */
+    uint32_t limit;     /* most hashes a group keeps explicitly */
+    Group *groups;
+    uint32_t count;     /* number of groups */
+    uint32_t allocated; /* number of groups there is room for */
+    uint32_t *slots;
+    uint32_t capacity;  /* number of slots, a power of 2 */
+} GroupedHyperLogLog;
+
+static void
+free_group(Group *group)
+{
+    free(group->key);
+    free(group->registers);
+    hllExplicitFree(&group->small);
+}
+
+static void
+GroupedHyperLogLog_dealloc(GroupedHyperLogLog *self)
+{
+    uint32_t i;
+
+    for (i = 0; i < self->count; i++)
+        free_group(&self->groups[i]);
+    free(self->groups);
+    free(self->slots);
+    #if PY_MAJOR_VERSION >= 3
+    Py_TYPE(self)->tp_free((PyObject*) self);
+    #else
+    self->ob_type->tp_free((PyObject*) self);
+    #endif
+}
+
+static PyObject *
+GroupedHyperLogLog_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    GroupedHyperLogLog *self;
+    self = (GroupedHyperLogLog *)type->tp_alloc(type, 0);
+    self->seed = 314;
+    return (PyObject *)self;
+}
+
+static int
+GroupedHyperLogLog_init(GroupedHyperLogLog *self, PyObject *args,
+                        PyObject *kwds)
+{
+    static char *kwlist[] = {"k", "seed", "hash", NULL};
+    const char *hash = NULL;
+    uint32_t seed = 314;
+    int k, hashId = HLL_HASH_MURMUR3;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|Is", kwlist,
+                                     &k, &seed, &hash))
+        return -1;
+
+    if (hash != NULL && (hashId = hllHashFromName(hash)) < 0) {
+        PyErr_Format(PyExc_ValueError, "Unknown hash '%s'.", hash);
+        return -1;
+    }
+
+    if (k < 2 || k > 16) {
+        char * msg = "Number of registers must be in the range [2^2, 2^16]";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    if (self->slots != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Already initialized.");
+        return -1;
+    }
+
+    self->k = k;
+    self->seed = seed;
+    self->hash = hashId;
+    self->size = 1 << k;
+    self->limit = hllExplicitLimit(k);
+    self->capacity = HLL_GROUPS_MIN_CAPACITY;
+    self->slots = (uint32_t *) calloc(self->capacity, sizeof(uint32_t));
+    if (self->slots == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Gets the slot holding the group with a key, or the empty slot it would go
+ * in. */
+static inline uint32_t *
+find_slot(GroupedHyperLogLog *self, const char *key, Py_ssize_t length,
+          uint64_t keyHash)
+{
+    uint32_t mask = self->capacity - 1;
+    uint32_t i = (uint32_t) keyHash & mask;
+    Group *group;
+
+    while (self->slots[i] != 0) {
+        group = &self->groups[self->slots[i] - 1];
+        if (group->keyHash == keyHash && group->keyLength == length &&
+            memcmp(group->key, key, length) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+
+    return &self->slots[i];
+}
+
+/* Doubles the number of slots, reinserting every group. */
+static int
+grow_slots(GroupedHyperLogLog *self)
+{
+    uint32_t *slots, mask, i, j;
+
+    slots = (uint32_t *) calloc((size_t) self->capacity * 2, sizeof(uint32_t));
+    if (slots == NULL)
+        return -1;
+
+    mask = self->capacity * 2 - 1;
+    for (i = 0; i < self->count; i++) {
+        j = (uint32_t) self->groups[i].keyHash & mask;
+        while (slots[j] != 0)
+            j = (j + 1) & mask;
+        slots[j] = i + 1;
+    }
+
+    free(self->slots);
+    self->slots = slots;
+    self->capacity *= 2;
+    return 0;
+}
+
+/* Appends an empty group with a copy of key. Returns -1 with an exception
+ * set on failure. */
+static int
+new_group(GroupedHyperLogLog *self, const char *key, Py_ssize_t length,
+          uint64_t keyHash)
+{
+    Group *group;
+
+    if (self->count == UINT32_MAX - 1) {
+        PyErr_SetString(PyExc_OverflowError, "Too many groups.");
+        return -1;
+    }
+
+    if (self->count == self->allocated) {
+        uint32_t allocated = self->allocated ? self->allocated * 2 : 16;
+        Group *groups;
+
+        if (allocated < self->allocated)
+            allocated = UINT32_MAX - 1;
+        groups = (Group *) realloc(self->groups, allocated * sizeof(Group));
+        if (groups == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->groups = groups;
+        self->allocated = allocated;
+    }
+
+    group = &self->groups[self->count];
+    memset(group, 0, sizeof(Group));
+    group->keyHash = keyHash;
+    group->keyLength = length;
+    group->key = (char *) malloc(length > 0 ? length : 1);
+    if (group->key == NULL)
+        goto nomem;
+    memcpy(group->key, key, length);
+
+    /* Sketches too small for an explicit set start with registers. */
+    if (self->limit == 0) {
+        group->registers = (char *) calloc(self->size, sizeof(char));
+        if (group->registers == NULL)
+            goto nomem;
+    } else if (hllExplicitInit(&group->small, self->limit) < 0) {
+        goto nomem;
+    }
+
+    self->count++;
+    return 0;
+
+nomem:
+    free_group(group);
+    PyErr_NoMemory();
+    return -1;
+}
+
+/* Gets the index of the group with a key, creating it if create is set.
+ * Returns -1 if there is no such group, or -1 with an exception set on
+ * failure. */
+static Py_ssize_t
+find_group(GroupedHyperLogLog *self, const char *key, Py_ssize_t length,
+           int create)
+{
+    uint64_t keyHash = hllXXH3(key, length, 0);
+    uint32_t *slot = find_slot(self, key, length, keyHash);
+
+    if (*slot != 0)
+        return *slot - 1;
+    if (!create)
+        return -1;
+
+    /* Keep the table at most three quarters full. */
+    if ((uint64_t) (self->count + 1) * 4 > (uint64_t) self->capacity * 3) {
+        if (grow_slots(self) < 0) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        slot = find_slot(self, key, length, keyHash);
+    }
+
+    if (new_group(self, key, length, keyHash) < 0)
+        return -1;
+
+    *slot = self->count;
+    return self->count - 1;
+}
+
+/* Replaces the explicit set of a group with registers. Returns -1 with an
+ * exception set on failure. */
+static int
+own_registers(GroupedHyperLogLog *self, Group *group)
+{
+    group->registers = (char *) calloc(self->size, sizeof(char));
+    if (group->registers == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    hllExplicitRegisters(&group->small, group->registers, self->k);
+    hllExplicitFree(&group->small);
+    return 0;
+}
+
+/* Adds a hash to the explicit set or the registers of a group. Returns -1
+ * with an exception set on failure. */
+static inline int
+add_hash(GroupedHyperLogLog *self, Group *group, uint32_t hash)
+{
+    uint32_t index, rank;
+
+    if (group->registers == NULL) {
+        switch (hllExplicitAdd(&group->small, hash)) {
+        case HLL_EXPLICIT_NOMEM:
+            PyErr_NoMemory();
+            return -1;
+        case HLL_EXPLICIT_FULL:
+            if (own_registers(self, group) < 0)
+                return -1;
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    index = hllIndex(hash, self->k);
+    rank = hllRank(hash, self->k);
+    if (rank > (uint8_t) group->registers[index])
+        group->registers[index] = rank;
+
+    return 0;
+}
+
+/* Adds an element to a group, creating the group on its first element. */
+static PyObject *
+GroupedHyperLogLog_add(GroupedHyperLogLog *self, PyObject *args)
+{
+    PyObject *groupKey, *key;
+    const char *group, *data;
+    Py_ssize_t groupLength, dataLength, i;
+    uint32_t hash;
+    int status;
+
+    if (!PyArg_ParseTuple(args, "OO", &groupKey, &key) ||
+        !hllKeyData(groupKey, &group, &groupLength) ||
+        !hllKeyData(key, &data, &dataLength))
+        return NULL;
+
+    hash = hllHash(self->hash, data, dataLength, self->seed);
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    i = find_group(self, group, groupLength, 1);
+    status = i < 0 ? -1 : add_hash(self, &self->groups[i], hash);
+    Py_END_CRITICAL_SECTION();
+
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Adds keys[i] to groups[i] for every i of two lists of length n. A group
+ * key repeated on consecutive rows is only looked up once. Returns -1 with an
+ * exception set on failure. */
+static int
+add_rows(GroupedHyperLogLog *self, PyObject *groups, PyObject *keys,
+         Py_ssize_t n)
+{
+    PyObject *groupKey, *previous = NULL;
+    const char *group, *data;
+    Py_ssize_t groupLength, dataLength, i, index = -1;
+
+    for (i = 0; i < n; i++) {
+        groupKey = PyList_GET_ITEM(groups, i);
+        if (groupKey != previous) {
+            if (!hllKeyData(groupKey, &group, &groupLength) ||
+                (index = find_group(self, group, groupLength, 1)) < 0)
+                return -1;
+            previous = groupKey;
+        }
+
+        if (!hllKeyData(PyList_GET_ITEM(keys, i), &data, &dataLength) ||
+            add_hash(self, &self->groups[index],
+                     hllHash(self->hash, data, dataLength, self->seed)) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Adds keys[i] to groups[i] for every i, in a single call. */
+static PyObject *
+GroupedHyperLogLog_add_many(GroupedHyperLogLog *self, PyObject *args)
+{
+    PyObject *groupKeys, *keys, *groupList = NULL, *keyList = NULL;
+    Py_ssize_t n;
+    int status = -1;
+
+    if (!PyArg_ParseTuple(args, "OO", &groupKeys, &keys))
+        return NULL;
+
+    /* Private lists keep every key alive while other threads run. */
+    if ((groupList = PySequence_List(groupKeys)) == NULL ||
+        (keyList = PySequence_List(keys)) == NULL)
+        goto done;
+
+    n = PyList_GET_SIZE(groupList);
+    if (PyList_GET_SIZE(keyList) != n) {
+        char * msg = "Groups and keys must have the same length.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        goto done;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    status = add_rows(self, groupList, keyList, n);
+    Py_END_CRITICAL_SECTION();
+
+done:
+    Py_XDECREF(groupList);
+    Py_XDECREF(keyList);
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Parses an optional estimator name. Returns -1 with an exception set if
+ * the name is unknown. */
+static int
+parse_estimator(const char *name)
+{
+    int estimator;
+
+    if (name == NULL)
+        return HLL_ESTIMATOR_CORRECTED;
+
+    if ((estimator = hllEstimatorFromName(name)) < 0)
+        PyErr_Format(PyExc_ValueError, "Unknown estimator '%s'.", name);
+
+    return estimator;
+}
+
+/* Gets the cardinality of a group, exact while it is explicit. */
+static double
+group_cardinality(GroupedHyperLogLog *self, const Group *group, int estimator)
+{
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+
+    if (group->registers == NULL)
+        return (double) group->small.count;
+
+    hllHistogram(group->registers, self->size, counts);
+    return hllEstimate(counts, self->k, estimator);
+}
+
+/* Gets the cardinality of a group, 0 if the group has no elements. */
+static PyObject *
+GroupedHyperLogLog_cardinality(GroupedHyperLogLog *self, PyObject *args,
+                               PyObject *kwds)
+{
+    static char *kwlist[] = {"group", "estimator", NULL};
+    PyObject *groupKey;
+    const char *name = NULL, *group;
+    Py_ssize_t groupLength, i;
+    double estimate = 0.0;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|s", kwlist,
+                                     &groupKey, &name) ||
+        !hllKeyData(groupKey, &group, &groupLength))
+        return NULL;
+
+    if ((estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if ((i = find_group(self, group, groupLength, 0)) >= 0)
+        estimate = group_cardinality(self, &self->groups[i], estimator);
+    Py_END_CRITICAL_SECTION();
+
+    return Py_BuildValue("d", estimate);
+}
+
+/* Builds a dict mapping every group key, as bytes, to its cardinality. */
+static PyObject *
+cardinality_dict(GroupedHyperLogLog *self, int estimator)
+{
+    PyObject *result, *key, *value;
+    int status;
+    uint32_t i;
+
+    result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+
+    for (i = 0; i < self->count; i++) {
+        key = PyBytes_FromStringAndSize(self->groups[i].key,
+                                        self->groups[i].keyLength);
+        value = PyFloat_FromDouble(group_cardinality(self, &self->groups[i],
+                                                     estimator));
+        status = key == NULL || value == NULL ? -1
+                                              : PyDict_SetItem(result, key,
+                                                               value);
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+        if (status < 0) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+
+    return result;
+}
+
+/* Gets a dict mapping every group key, as bytes, to its cardinality. */
+static PyObject *
+GroupedHyperLogLog_cardinalities(GroupedHyperLogLog *self, PyObject *args,
+                                 PyObject *kwds)
+{
+    static char *kwlist[] = {"estimator", NULL};
+    const char *name = NULL;
+    PyObject *result;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &name))
+        return NULL;
+
+    if ((estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = cardinality_dict(self, estimator);
+    Py_END_CRITICAL_SECTION();
+
+    return result;
+}
+
+/* Copies the sketch of the group with a key into an empty HyperLogLog of
+ * the same size. Returns -1 with an exception set on failure. */
+static int
+copy_group(GroupedHyperLogLog *self, PyObject *groupKey, const char *group,
+           Py_ssize_t groupLength, HyperLogLog *hll)
+{
+    Py_ssize_t i;
+    Group *source;
+
+    if ((i = find_group(self, group, groupLength, 0)) < 0) {
+        PyErr_SetObject(PyExc_KeyError, groupKey);
+        return -1;
+    }
+
+    source = &self->groups[i];
+    if (source->registers == NULL && hll->registers == NULL) {
+        hllExplicitFree(&hll->small);
+        if (hllExplicitCopy(&hll->small, &source->small) < 0) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        return 0;
+    }
+
+    if (hllOwnRegisters(hll) < 0)
+        return -1;
+
+    if (source->registers == NULL)
+        hllExplicitRegisters(&source->small, hll->registers, self->k);
+    else
+        memcpy(hll->registers, source->registers, self->size);
+
+    return 0;
+}
+
+/* Gets a HyperLogLog with a copy of a group's sketch. */
+static PyObject *
+GroupedHyperLogLog_get(GroupedHyperLogLog *self, PyObject *groupKey)
+{
+    HyperLogLog *hll;
+    const char *group;
+    Py_ssize_t groupLength;
+    int status;
+
+    if (!hllKeyData(groupKey, &group, &groupLength))
+        return NULL;
+
+    hll = (HyperLogLog *) PyObject_CallFunction((PyObject *) &HyperLogLogType,
+                                                "iIis", self->k, self->seed,
+                                                HLL_THREADSAFE_DEFAULT,
+                                                hllHashName(self->hash));
+    if (hll == NULL)
+        return NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    status = copy_group(self, groupKey, group, groupLength, hll);
+    Py_END_CRITICAL_SECTION();
+
+    if (status < 0) {
+        Py_DECREF(hll);
+        return NULL;
+    }
+
+    return (PyObject *) hll;
+}
+
+/* Builds a list of the group keys, as bytes, in the order the groups were
+ * created. */
+static PyObject *
+group_keys(GroupedHyperLogLog *self)
+{
+    PyObject *result, *key;
+    uint32_t i;
+
+    result = PyList_New(self->count);
+    if (result == NULL)
+        return NULL;
+
+    for (i = 0; i < self->count; i++) {
+        key = PyBytes_FromStringAndSize(self->groups[i].key,
+                                        self->groups[i].keyLength);
+        if (key == NULL) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, i, key);
+    }
+
+    return result;
+}
+
+/* Gets a list of the group keys in the order the groups were created. */
+static PyObject *
+GroupedHyperLogLog_groups(GroupedHyperLogLog *self)
+{
+    PyObject *result;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = group_keys(self);
+    Py_END_CRITICAL_SECTION();
+
+    return result;
+}
+
+/* Merges a group of another GroupedHyperLogLog into a group. Returns -1
+ * with an exception set on failure. */
+static int
+merge_group(GroupedHyperLogLog *self, Group *group, const Group *other)
+{
+    int status;
+
+    if (group->registers == NULL) {
+        if (other->registers == NULL) {
+            status = hllExplicitMerge(&group->small, &other->small);
+            if (status == 0)
+                return 0;
+            if (status == HLL_EXPLICIT_NOMEM) {
+                PyErr_NoMemory();
+                return -1;
+            }
+        }
+        if (own_registers(self, group) < 0)
+            return -1;
+    }
+
+    if (other->registers == NULL)
+        hllExplicitRegisters(&other->small, group->registers, self->k);
+    else
+        hllMerge(group->registers, other->registers, self->size);
+
+    return 0;
+}
+
+/* Merges every group of other into the group with the same key. Returns -1
+ * with an exception set on failure. */
+static int
+merge_groups(GroupedHyperLogLog *self, GroupedHyperLogLog *other)
+{
+    const Group *source;
+    Py_ssize_t index;
+    uint32_t i;
+
+    for (i = 0; i < other->count; i++) {
+        source = &other->groups[i];
+        index = find_group(self, source->key, source->keyLength, 1);
+        if (index < 0 || merge_group(self, &self->groups[index], source) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Merges every group of another GroupedHyperLogLog into the group with the
+ * same key, creating the groups missing here. */
+static PyObject *
+GroupedHyperLogLog_merge(GroupedHyperLogLog *self, PyObject *arg)
+{
+    GroupedHyperLogLog *other = (GroupedHyperLogLog *) arg;
+    int status;
+
+    if (!PyObject_TypeCheck(arg, &GroupedHyperLogLogType)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a GroupedHyperLogLog.");
+        return NULL;
+    }
+
+    if (other->k != self->k) {
+        char * msg = "GroupedHyperLogLogs must be the same size.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    if (other->seed != self->seed || other->hash != self->hash) {
+        char * msg = "GroupedHyperLogLogs must use the same hash and seed.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    if (other == self) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION2(self, other);
+    status = merge_groups(self, other);
+    Py_END_CRITICAL_SECTION2();
+
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Gets the name of the hash function. */
+static PyObject *
+GroupedHyperLogLog_hash(GroupedHyperLogLog *self)
+{
+    #if PY_MAJOR_VERSION >= 3
+    return PyUnicode_FromString(hllHashName(self->hash));
+    #else
+    return PyString_FromString(hllHashName(self->hash));
+    #endif
+}
+
+/* Gets the seed value used in the hash. */
+static PyObject *
+GroupedHyperLogLog_seed(GroupedHyperLogLog *self)
+{
+    return Py_BuildValue("I", self->seed);
+}
+
+/* Gets the number of registers in each group. */
+static PyObject *
+GroupedHyperLogLog_size(GroupedHyperLogLog *self)
+{
+    return Py_BuildValue("I", self->size);
+}
+
+static Py_ssize_t
+GroupedHyperLogLog_length(GroupedHyperLogLog *self)
+{
+    return self->count;
+}
+
+static PyMethodDef GroupedHyperLogLog_methods[] = {
+    {"add", (PyCFunction)GroupedHyperLogLog_add, METH_VARARGS,
+     "Add an element to a group."
+    },
+    {"add_many", (PyCFunction)GroupedHyperLogLog_add_many, METH_VARARGS,
+     "Add each element of keys to the group at the same position of groups."
+    },
+    {"cardinalities", (PyCFunction)GroupedHyperLogLog_cardinalities,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get a dict mapping every group to its cardinality."
+    },
+    {"cardinality", (PyCFunction)GroupedHyperLogLog_cardinality,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get the cardinality of a group."
+    },
+    {"get", (PyCFunction)GroupedHyperLogLog_get, METH_O,
+     "Get a HyperLogLog with a copy of a group."
+    },
+    {"groups", (PyCFunction)GroupedHyperLogLog_groups, METH_NOARGS,
+     "Get a list of the group keys."
+    },
+    {"hash", (PyCFunction)GroupedHyperLogLog_hash, METH_NOARGS,
+     "Get the name of the hash function."
+    },
+    {"merge", (PyCFunction)GroupedHyperLogLog_merge, METH_O,
+     "Merge every group of another GroupedHyperLogLog into this one."
+    },
+    {"seed", (PyCFunction)GroupedHyperLogLog_seed, METH_NOARGS,
+     "Get the seed used in the hash."
+    },
+    {"size", (PyCFunction)GroupedHyperLogLog_size, METH_NOARGS,
+     "Returns the number of registers in each group."
+    },
+    {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods GroupedHyperLogLog_as_sequence = {
+    (lenfunc)GroupedHyperLogLog_length, /*sq_length*/
+};
+
+PyTypeObject GroupedHyperLogLogType = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    #endif
+    "HLL.GroupedHyperLogLog",  /*tp_name*/
+    sizeof(GroupedHyperLogLog), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)GroupedHyperLogLog_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &GroupedHyperLogLog_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT |
+        Py_TPFLAGS_BASETYPE,   /*tp_flags*/
+    "HyperLogLogs of many groups, keyed by group", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    GroupedHyperLogLog_methods, /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)GroupedHyperLogLog_init, /* tp_init */
+    0,                         /* tp_alloc */
+    GroupedHyperLogLog_new,    /* tp_new */
+};
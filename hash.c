@@ -0,0 +1,396 @@
+#include "hash.h"
+#include <string.h>
+
+/* xxHash and wyhash read little endian words, byte swapped on big endian
+ * machines so hashes are the same everywhere. */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HLL_LE32(x) __builtin_bswap32(x)
+#define HLL_LE64(x) __builtin_bswap64(x)
+#else
+#define HLL_LE32(x) (x)
+#define HLL_LE64(x) (x)
+#endif
+
+static const char *hashNames[] = {"murmur3", "xxh3", "wyhash"};
+
+/* Gets the hash with the given name, or -1 for an unknown name. */
+int hllHashFromName(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int) (sizeof(hashNames) / sizeof(hashNames[0])); i++) {
+        if (strcmp(name, hashNames[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+const char *hllHashName(int hash)
+{
+    return hashNames[hash];
+}
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return HLL_LE32(v);
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return HLL_LE64(v);
+}
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* Multiplies a and b into a 128 bit product split into its low and high
+ * halves. */
+static inline void
+mul128(uint64_t a, uint64_t b, uint64_t *lo, uint64_t *hi)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = (__uint128_t) a * b;
+    *lo = (uint64_t) product;
+    *hi = (uint64_t) (product >> 64);
+#else
+    uint64_t lolo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hilo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lohi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hihi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lolo >> 32) + (hilo & 0xFFFFFFFF) + lohi;
+    *hi = (hilo >> 32) + (cross >> 32) + hihi;
+    *lo = (cross << 32) | (lolo & 0xFFFFFFFF);
+#endif
+}
+
+static inline uint64_t
+mul128_fold64(uint64_t a, uint64_t b)
+{
+    uint64_t lo, hi;
+    mul128(a, b, &lo, &hi);
+    return lo ^ hi;
+}
+
+/* XXH3 64 bit, a port of the scalar code paths of the xxHash reference
+ * implementation (BSD 2-Clause, Yann Collet). */
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_SIZE 192
+#define XXH_MIDSIZE_MAX 240
+#define XXH_STRIPE_LEN 64
+#define XXH_SECRET_CONSUME_RATE 8
+#define XXH_ACC_NB 8
+
+static const uint8_t xxhSecret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint64_t
+xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t
+xxh3_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t
+xxh3_rrmxmx(uint64_t h, uint64_t length)
+{
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= XXH_PRIME_MX2;
+    h ^= (h >> 35) + length;
+    h *= XXH_PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static inline uint64_t
+xxh3_mix16(const uint8_t *p, const uint8_t *secret, uint64_t seed)
+{
+    return mul128_fold64(read64(p) ^ (read64(secret) + seed),
+                         read64(p + 8) ^ (read64(secret + 8) - seed));
+}
+
+static uint64_t
+xxh3_0to16(const uint8_t *p, size_t length, uint64_t seed)
+{
+    const uint8_t *secret = xxhSecret;
+
+    if (length > 8) {
+        uint64_t lo = read64(p) ^
+                      ((read64(secret + 24) ^ read64(secret + 32)) + seed);
+        uint64_t hi = read64(p + length - 8) ^
+                      ((read64(secret + 40) ^ read64(secret + 48)) - seed);
+        return xxh3_avalanche(length + __builtin_bswap64(lo) + hi +
+                              mul128_fold64(lo, hi));
+    }
+
+    if (length >= 4) {
+        uint64_t input, bitflip;
+
+        seed ^= (uint64_t) __builtin_bswap32((uint32_t) seed) << 32;
+        input = read32(p + length - 4) + ((uint64_t) read32(p) << 32);
+        bitflip = (read64(secret + 8) ^ read64(secret + 16)) - seed;
+        return xxh3_rrmxmx(input ^ bitflip, length);
+    }
+
+    if (length > 0) {
+        uint32_t combined = ((uint32_t) p[0] << 16) |
+                            ((uint32_t) p[length >> 1] << 24) |
+                            (uint32_t) p[length - 1] |
+                            ((uint32_t) length << 8);
+        uint64_t bitflip = (read32(secret) ^ read32(secret + 4)) + seed;
+        return xxh64_avalanche((uint64_t) combined ^ bitflip);
+    }
+
+    return xxh64_avalanche(seed ^ read64(secret + 56) ^ read64(secret + 64));
+}
+
+static uint64_t
+xxh3_17to128(const uint8_t *p, size_t length, uint64_t seed)
+{
+    const uint8_t *secret = xxhSecret;
+    uint64_t acc = length * XXH_PRIME64_1;
+
+    if (length > 32) {
+        if (length > 64) {
+            if (length > 96) {
+                acc += xxh3_mix16(p + 48, secret + 96, seed);
+                acc += xxh3_mix16(p + length - 64, secret + 112, seed);
+            }
+            acc += xxh3_mix16(p + 32, secret + 64, seed);
+            acc += xxh3_mix16(p + length - 48, secret + 80, seed);
+        }
+        acc += xxh3_mix16(p + 16, secret + 32, seed);
+        acc += xxh3_mix16(p + length - 32, secret + 48, seed);
+    }
+    acc += xxh3_mix16(p, secret, seed);
+    acc += xxh3_mix16(p + length - 16, secret + 16, seed);
+
+    return xxh3_avalanche(acc);
+}
+
+static uint64_t
+xxh3_129to240(const uint8_t *p, size_t length, uint64_t seed)
+{
+    const uint8_t *secret = xxhSecret;
+    uint64_t acc = length * XXH_PRIME64_1, end;
+    unsigned int i, rounds = (unsigned int) length / 16;
+
+    for (i = 0; i < 8; i++)
+        acc += xxh3_mix16(p + 16 * i, secret + 16 * i, seed);
+    acc = xxh3_avalanche(acc);
+
+    /* The secret is smaller than the input, later rounds restart it at an
+     * offset of 3, and the last 16 bytes use the secret 17 bytes before the
+     * end of the minimum secret size of 136. */
+    end = xxh3_mix16(p + length - 16, secret + 136 - 17, seed);
+    for (i = 8; i < rounds; i++)
+        end += xxh3_mix16(p + 16 * i, secret + 16 * (i - 8) + 3, seed);
+
+    return xxh3_avalanche(acc + end);
+}
+
+static inline void
+xxh3_accumulate512(uint64_t *acc, const uint8_t *p, const uint8_t *secret)
+{
+    int i;
+
+    for (i = 0; i < XXH_ACC_NB; i++) {
+        uint64_t value = read64(p + 8 * i);
+        uint64_t key = value ^ read64(secret + 8 * i);
+        acc[i ^ 1] += value;
+        acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+}
+
+static inline void
+xxh3_scramble(uint64_t *acc, const uint8_t *secret)
+{
+    int i;
+
+    for (i = 0; i < XXH_ACC_NB; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        acc[i] = a * XXH_PRIME32_1;
+    }
+}
+
+static uint64_t
+xxh3_long(const uint8_t *p, size_t length, uint64_t seed)
+{
+    uint64_t acc[XXH_ACC_NB] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+    uint8_t custom[XXH_SECRET_SIZE];
+    const uint8_t *secret = xxhSecret;
+    size_t stripesPerBlock = (XXH_SECRET_SIZE - XXH_STRIPE_LEN) /
+                             XXH_SECRET_CONSUME_RATE;
+    size_t blockLength = XXH_STRIPE_LEN * stripesPerBlock;
+    size_t blocks = (length - 1) / blockLength;
+    size_t n, s, stripes;
+    uint64_t result;
+    int i;
+
+    /* A seed derives a custom secret from the default one. */
+    if (seed != 0) {
+        for (i = 0; i < XXH_SECRET_SIZE / 16; i++) {
+            uint64_t lo = HLL_LE64(read64(xxhSecret + 16 * i) + seed);
+            uint64_t hi = HLL_LE64(read64(xxhSecret + 16 * i + 8) - seed);
+            memcpy(custom + 16 * i, &lo, 8);
+            memcpy(custom + 16 * i + 8, &hi, 8);
+        }
+        secret = custom;
+    }
+
+    for (n = 0; n < blocks; n++) {
+        for (s = 0; s < stripesPerBlock; s++)
+            xxh3_accumulate512(acc, p + n * blockLength + s * XXH_STRIPE_LEN,
+                               secret + s * XXH_SECRET_CONSUME_RATE);
+        xxh3_scramble(acc, secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+    }
+
+    stripes = ((length - 1) - blockLength * blocks) / XXH_STRIPE_LEN;
+    for (s = 0; s < stripes; s++)
+        xxh3_accumulate512(acc, p + blocks * blockLength + s * XXH_STRIPE_LEN,
+                           secret + s * XXH_SECRET_CONSUME_RATE);
+    xxh3_accumulate512(acc, p + length - XXH_STRIPE_LEN,
+                       secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - 7);
+
+    result = length * XXH_PRIME64_1;
+    for (i = 0; i < 4; i++)
+        result += mul128_fold64(acc[2 * i] ^ read64(secret + 11 + 16 * i),
+                                acc[2 * i + 1] ^
+                                read64(secret + 11 + 16 * i + 8));
+
+    return xxh3_avalanche(result);
+}
+
+/* Gets the 64 bit XXH3 hash of data, equal to XXH3_64bits_withSeed(). */
+uint64_t hllXXH3(const void *data, size_t length, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *) data;
+
+    if (length <= 16)
+        return xxh3_0to16(p, length, seed);
+    if (length <= 128)
+        return xxh3_17to128(p, length, seed);
+    if (length <= XXH_MIDSIZE_MAX)
+        return xxh3_129to240(p, length, seed);
+    return xxh3_long(p, length, seed);
+}
+
+/* wyhash final version 4 by Wang Yi, released into the public domain, with
+ * its default secret. */
+
+static const uint64_t wySecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static inline uint64_t
+wymix(uint64_t a, uint64_t b)
+{
+    return mul128_fold64(a, b);
+}
+
+/* Gets the 64 bit wyhash of data. */
+uint64_t hllWyhash(const void *data, size_t length, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *) data;
+    const uint64_t *secret = wySecret;
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ secret[0], secret[1]);
+
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t offset = (length >> 3) << 2;
+            a = ((uint64_t) read32(p) << 32) | read32(p + offset);
+            b = ((uint64_t) read32(p + length - 4) << 32) |
+                read32(p + length - 4 - offset);
+        } else if (length > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[length >> 1] << 8) |
+                p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = length;
+
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+                see1 = wymix(read64(p + 16) ^ secret[2],
+                             read64(p + 24) ^ see1);
+                see2 = wymix(read64(p + 32) ^ secret[3],
+                             read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    mul128(a, b, &a, &b);
+    return wymix(a ^ secret[0] ^ length, b ^ secret[1]);
+}
@@ -0,0 +1,52 @@
+#ifndef _HLL_HASH_H_
+#define _HLL_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "murmur3.h"
+
+/* Hash functions an estimator can be built with. */
+enum {
+    HLL_HASH_MURMUR3, /* MurmurHash3_x86_32 */
+    HLL_HASH_XXH3,    /* XXH3_64bits_withSeed from xxHash 0.8 */
+    HLL_HASH_WYHASH   /* wyhash final version 4 */
+};
+
+int hllHashFromName(const char *name);
+
+const char *hllHashName(int hash);
+
+uint64_t hllXXH3(const void *data, size_t length, uint64_t seed);
+
+uint64_t hllWyhash(const void *data, size_t length, uint64_t seed);
+
+/* Hashes data to the 32 bits that select a register and its rank. The 64 bit
+ * hashes contribute their high half. */
+static inline uint32_t
+hllHash(int hash, const void *data, size_t length, uint32_t seed)
+{
+    uint32_t out;
+
+    switch (hash) {
+    case HLL_HASH_XXH3:
+        return (uint32_t) (hllXXH3(data, length, seed) >> 32);
+    case HLL_HASH_WYHASH:
+        return (uint32_t) (hllWyhash(data, length, seed) >> 32);
+    default:
+        MurmurHash3_x86_32(data, (int) length, seed, (void *) &out);
+        return out;
+    }
+}
+
+/* Hashes data to 64 bits, only for the 64 bit hashes. The high half is the
+ * hash hllHash() gets. */
+static inline uint64_t
+hllHash64(int hash, const void *data, size_t length, uint32_t seed)
+{
+    if (hash == HLL_HASH_WYHASH)
+        return hllWyhash(data, length, seed);
+
+    return hllXXH3(data, length, seed);
+}
+
+#endif // _HLL_HASH_H_
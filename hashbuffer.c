@@ -0,0 +1,127 @@
+#include "hll.h"
+#include <stdlib.h>
+
+#if PY_MAJOR_VERSION >= 3
+#define HLL_TPFLAGS_HAVE_NEWBUFFER 0
+#else
+#define HLL_TPFLAGS_HAVE_NEWBUFFER Py_TPFLAGS_HAVE_NEWBUFFER
+#endif
+
+/* Creates an uninitialized buffer of count hashes that are width bytes wide.
+ */
+HashBuffer *
+hllHashBufferNew(Py_ssize_t count, int width)
+{
+    HashBuffer *self = PyObject_New(HashBuffer, &HashBufferType);
+
+    if (self == NULL)
+        return NULL;
+
+    self->count = count;
+    self->width = width;
+    self->hashes = malloc(count > 0 ? count * width : 1);
+    if (self->hashes == NULL) {
+        Py_DECREF(self);
+        return (HashBuffer *) PyErr_NoMemory();
+    }
+
+    return self;
+}
+
+static void
+HashBuffer_dealloc(HashBuffer *self)
+{
+    free(self->hashes);
+    PyObject_Del(self);
+}
+
+static Py_ssize_t
+HashBuffer_length(HashBuffer *self)
+{
+    return self->count;
+}
+
+static PyObject *
+HashBuffer_item(HashBuffer *self, Py_ssize_t i)
+{
+    if (i < 0 || i >= self->count) {
+        PyErr_SetString(PyExc_IndexError, "Index out of range.");
+        return NULL;
+    }
+
+    if (self->width == 4)
+        return PyLong_FromUnsignedLong(((uint32_t *) self->hashes)[i]);
+
+    return PyLong_FromUnsignedLongLong(((uint64_t *) self->hashes)[i]);
+}
+
+/* Exports the hashes as a one dimensional array of native unsigned integers,
+ * the format numpy and memoryview expect. */
+static int
+HashBuffer_getbuffer(HashBuffer *self, Py_buffer *view, int flags)
+{
+    view->obj = (PyObject *) self;
+    Py_INCREF(self);
+    view->buf = self->hashes;
+    view->len = self->count * self->width;
+    view->readonly = 0;
+    view->itemsize = self->width;
+    view->format = NULL;
+    if (flags & PyBUF_FORMAT)
+        view->format = self->width == 4 ? "I" : "Q";
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->count : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &self->width : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    return 0;
+}
+
+static PySequenceMethods HashBuffer_as_sequence = {
+    (lenfunc)HashBuffer_length,     /*sq_length*/
+    0,                              /*sq_concat*/
+    0,                              /*sq_repeat*/
+    (ssizeargfunc)HashBuffer_item,  /*sq_item*/
+};
+
+static PyBufferProcs HashBuffer_as_buffer = {
+    #if PY_MAJOR_VERSION < 3
+    0,                              /*bf_getreadbuffer*/
+    0,                              /*bf_getwritebuffer*/
+    0,                              /*bf_getsegcount*/
+    0,                              /*bf_getcharbuffer*/
+    #endif
+    (getbufferproc)HashBuffer_getbuffer, /*bf_getbuffer*/
+    0,                              /*bf_releasebuffer*/
+};
+
+PyTypeObject HashBufferType = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    #endif
+    "HLL.HashBuffer",          /*tp_name*/
+    sizeof(HashBuffer),        /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)HashBuffer_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &HashBuffer_as_sequence,   /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &HashBuffer_as_buffer,     /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT |
+        HLL_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "Hashes returned by HyperLogLog.hash_many()", /* tp_doc */
+};
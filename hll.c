@@ -1,354 +1,2127 @@
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include "structmember.h"
 #include "hll.h"
-#include "const.h"
+#include "batch.h"
+#include "estimate.h"
+#include "hash.h"
 #include "murmur3.h"
+#include "registers.h"
 #include <math.h>
+#include <sched.h>
 #include <stdint.h>
+#include <string.h>
 
+/* Binary operators receive operands of other types without coercion. */
+#if PY_MAJOR_VERSION >= 3
+#define HLL_TPFLAGS_CHECKTYPES 0
+#else
+#define HLL_TPFLAGS_CHECKTYPES Py_TPFLAGS_CHECKTYPES
+#endif
+
+/* Compound keys up to this many bytes are encoded on the stack. */
+#define HLL_KEY_STACK 256
+
+/* Readers waiting for a write to end yield the CPU after this many tries. */
+#define HLL_READ_SPINS 64
+
+/* Registers shared with snapshots are counted, shares is NULL while the
+ * registers belong to one HyperLogLog. Whoever modifies shared registers
+ * first copies them, see hllOwnRegisters(). */
+static void
+release_registers(HyperLogLog *self)
+{
+    if (self->shared.obj != NULL) {
+        PyBuffer_Release(&self->shared);
+    } else if (self->shares == NULL) {
+        free(self->registers);
+    } else if (__atomic_fetch_sub(self->shares, 1, __ATOMIC_ACQ_REL) == 1) {
+        free(self->shares);
+        free(self->registers);
+    }
+    self->shares = NULL;
+    self->registers = NULL;
+}
+
+/* Gives self registers of its own to write to. An explicit HyperLogLog
+ * converts its hashes to registers. Registers shared with snapshots are
+ * copied before giving up the share, so the registers never change while
+ * another HyperLogLog is still copying them. The caller holds a critical
+ * section on self unless no other thread can see it, see own_registers().
+ * Returns -1 with an exception set on failure. */
+int
+hllOwnRegisters(HyperLogLog *self)
+{
+    char *copy;
+
+    if (self->registers == NULL) {
+        copy = (char *) calloc(self->size, sizeof(char));
+        if (copy == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        hllExplicitRegisters(&self->small, copy, self->k);
+        hllExplicitFree(&self->small);
+        __atomic_store_n(&self->registers, copy, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    if (self->shares == NULL)
+        return 0;
+
+    copy = (char *) malloc(self->size * sizeof(char));
+    if (copy == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(copy, self->registers, self->size);
+
+    if (__atomic_fetch_sub(self->shares, 1, __ATOMIC_ACQ_REL) == 1) {
+        free(self->shares);
+        free(copy);
+    } else {
+        __atomic_store_n(&self->registers, copy, __ATOMIC_RELEASE);
+    }
+    self->shares = NULL;
+
+    return 0;
+}
+
+/* Calls hllOwnRegisters() in a critical section, as other threads may be
+ * converting or unsharing the same registers. Registers self already owns
+ * only change in reduce_precision(). */
+static int
+own_registers(HyperLogLog *self)
+{
+    int status;
+
+    if (self->registers != NULL && self->shares == NULL)
+        return 0;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    status = hllOwnRegisters(self);
+    Py_END_CRITICAL_SECTION();
+
+    return status;
+}
+
+static void
+HyperLogLog_dealloc(HyperLogLog* self)
+{
+    release_registers(self);
+    hllExplicitFree(&self->small);
+    #if PY_MAJOR_VERSION >= 3
+    Py_TYPE(self)->tp_free((PyObject*) self);
+    #else
+    self->ob_type->tp_free((PyObject*) self);
+    #endif
+}
+
+static PyObject *
+HyperLogLog_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    HyperLogLog *self;
+    self = (HyperLogLog *)type->tp_alloc(type, 0);
+    self->seed = 314;
+    self->threadsafe = HLL_THREADSAFE_DEFAULT;
+    return (PyObject *)self;
+}
+
+static int
+HyperLogLog_init(HyperLogLog *self, PyObject *args, PyObject *kwds)
+{ 
+    static char *kwlist[] = {"k", "seed", "threadsafe", "hash", NULL};
+    const char *hash = NULL;
+    uint32_t limit;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|Iis", kwlist, 
+				      &self->k, &self->seed, &self->threadsafe,
+				      &hash)) {
+        return -1; 
+    }
+
+    if (hash != NULL && (self->hash = hllHashFromName(hash)) < 0) {
+        PyErr_Format(PyExc_ValueError, "Unknown hash '%s'.", hash);
+        return -1;
+    }
+
+    if (self->k < 2 || self->k > 16) {
+        char * msg = "Number of registers must be in the range [2^2, 2^16]";
+        PyErr_SetString(PyExc_ValueError, msg);
+	return -1;
+    } 
+
+    self->size = 1 << self->k;
+
+    /* Small sets are counted exactly until they would take more memory than
+     * the registers. Registers updated without the GIL are always dense. */
+    limit = hllExplicitLimit(self->k);
+    if (!self->threadsafe && limit > 0) {
+        if (hllExplicitInit(&self->small, limit) < 0) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        return 0;
+    }
+
+    self->registers = (char *) malloc(self->size * sizeof(char));
+    memset(self->registers, 0, self->size);
+
+    return 0; 
+}
+
+static PyMemberDef HyperLogLog_members[] = { 
+    {NULL} /* Sentinel */
+};
+
+/* Writes that update many registers are counted before and after, so readers
+ * can tell whether they overlapped one, like a seqlock that allows several
+ * writers. Single register updates need no counting, a reader sees them
+ * either before or after. */
+static void
+begin_write(HyperLogLog *self)
+{
+    __atomic_fetch_add(&self->writesBegun, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+end_write(HyperLogLog *self)
+{
+    __atomic_fetch_add(&self->writesEnded, 1, __ATOMIC_RELEASE);
+}
+
+/* Whether a bulk write is in progress, which may run without the GIL. */
+static int
+writing(HyperLogLog *self)
+{
+    return __atomic_load_n(&self->writesBegun, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&self->writesEnded, __ATOMIC_ACQUIRE);
+}
+
+/* Waits until no write is in progress and returns the number of writes
+ * begun, to be checked by end_read(). */
+static uint64_t
+begin_read(HyperLogLog *self)
+{
+    uint64_t begun;
+    int spins = 0;
+
+    for (;;) {
+        begun = __atomic_load_n(&self->writesBegun, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&self->writesEnded, __ATOMIC_ACQUIRE) == begun)
+            return begun;
+
+        if (++spins >= HLL_READ_SPINS) {
+            Py_BEGIN_ALLOW_THREADS
+            sched_yield();
+            Py_END_ALLOW_THREADS
+        }
+    }
+}
+
+/* Checks that no write began since begin_read(), so the registers read in
+ * between are a consistent snapshot. */
+static int
+end_read(HyperLogLog *self, uint64_t begun)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&self->writesBegun, __ATOMIC_RELAXED) == begun;
+}
+
+/* Sets the zeroed registers to those of the hashes of an explicit
+ * HyperLogLog. The set is read in a critical section, as another thread may
+ * be growing or converting it. Returns 0 if self has registers by then. */
+static int
+explicit_registers(HyperLogLog *self, char *registers)
+{
+    int filled = 0;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->registers == NULL) {
+        hllExplicitRegisters(&self->small, registers, self->k);
+        filled = 1;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    return filled;
+}
+
+/* Gets the number of hashes of an explicit HyperLogLog in *count. Returns 0
+ * if self has registers by then. */
+static int
+explicit_count(HyperLogLog *self, uint32_t *count)
+{
+    int found = 0;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->registers == NULL) {
+        *count = self->small.count;
+        found = 1;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    return found;
+}
+
+/* Counts the registers with each rank from a consistent snapshot. Returns
+ * -1 with an exception set on failure. */
+static int
+snapshot_histogram(HyperLogLog *self, uint32_t *counts)
+{
+    uint64_t begun;
+    char *registers;
+    int filled;
+
+    if (self->registers == NULL) {
+        registers = (char *) calloc(self->size, sizeof(char));
+        if (registers == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        if ((filled = explicit_registers(self, registers)))
+            hllHistogram(registers, self->size, counts);
+        free(registers);
+        if (filled)
+            return 0;
+    }
+
+    do {
+        begun = begin_read(self);
+        hllHistogram(self->registers, self->size, counts);
+    } while (!end_read(self, begun));
+
+    return 0;
+}
+
+/* Copies a consistent snapshot of the registers. */
+static void
+snapshot_registers(HyperLogLog *self, char *registers)
+{
+    uint64_t begun;
+
+    if (self->registers == NULL) {
+        memset(registers, 0, self->size);
+        if (explicit_registers(self, registers))
+            return;
+    }
+
+    do {
+        begun = begin_read(self);
+        memcpy(registers, self->registers, self->size);
+    } while (!end_read(self, begun));
+}
+
+/* Gets the registers of hll to read from. An explicit HyperLogLog has none,
+ * so they are computed into *temp, which the caller frees. Returns NULL with
+ * an exception set on failure. */
+static const char *
+read_registers(HyperLogLog *hll, char **temp)
+{
+    *temp = NULL;
+    if (hll->registers != NULL)
+        return hll->registers;
+
+    *temp = (char *) malloc(hll->size * sizeof(char));
+    if (*temp == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    snapshot_registers(hll, *temp);
+
+    return *temp;
+}
+
+/* Registers of another HyperLogLog read without the GIL, see
+ * pin_registers(). */
+typedef struct {
+    HyperLogLog *hll;
+    char *registers;
+    short int k;      /* precision of the registers */
+    uint32_t *shares; /* share held on registers shared with snapshots */
+    char *temp;       /* registers computed for an explicit HyperLogLog */
+} PinnedRegisters;
+
+/* Gets the registers of hll for reading without the GIL, until
+ * unpin_registers(). Pinned registers are never resized or shared with a
+ * snapshot, and registers that already are keep a share of their own, so
+ * they outlive hll copying them. An explicit HyperLogLog gets temporary
+ * registers instead. Returns -1 with an exception set on failure. */
+static int
+pin_registers(HyperLogLog *hll, PinnedRegisters *pin)
+{
+    pin->hll = hll;
+    pin->registers = NULL;
+    pin->shares = NULL;
+    pin->temp = NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(hll);
+    pin->k = hll->k;
+    if (hll->registers != NULL) {
+        __atomic_fetch_add(&hll->pins, 1, __ATOMIC_ACQ_REL);
+        if ((pin->shares = hll->shares) != NULL)
+            __atomic_fetch_add(pin->shares, 1, __ATOMIC_RELAXED);
+        pin->registers = hll->registers;
+    } else if ((pin->temp = (char *) calloc(hll->size, 1)) != NULL) {
+        hllExplicitRegisters(&hll->small, pin->temp, hll->k);
+        pin->registers = pin->temp;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (pin->registers == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Releases registers pinned by pin_registers(), doesn't need the GIL. */
+static void
+unpin_registers(PinnedRegisters *pin)
+{
+    if (pin->temp != NULL) {
+        free(pin->temp);
+        return;
+    }
+
+    if (pin->shares != NULL &&
+        __atomic_fetch_sub(pin->shares, 1, __ATOMIC_ACQ_REL) == 1) {
+        free(pin->shares);
+        free(pin->registers);
+    }
+    __atomic_fetch_sub(&pin->hll->pins, 1, __ATOMIC_RELEASE);
+}
+
+/* Adds a hash to the explicit set of self, see add_explicit(). */
+static int
+insert_explicit(HyperLogLog *self, uint32_t hash)
+{
+    switch (hllExplicitAdd(&self->small, hash)) {
+    case HLL_EXPLICIT_NOMEM:
+        PyErr_NoMemory();
+        return -1;
+    case HLL_EXPLICIT_FULL:
+        return hllOwnRegisters(self) < 0 ? -1 : 1;
+    default:
+        return 0;
+    }
+}
+
+/* Adds a hash to the explicit set of self. Once the set is full self
+ * converts to registers and 1 is returned, the caller then adds the hash to
+ * the registers. The set grows and converts in a critical section, so
+ * threads adding at once never see it half done. Returns -1 with an
+ * exception set on failure. */
+static int
+add_explicit(HyperLogLog *self, uint32_t hash)
+{
+    int status = 1;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->registers == NULL)
+        status = insert_explicit(self, hash);
+    Py_END_CRITICAL_SECTION();
+
+    return status;
+}
+
+/* Adds a hash to the explicit set or the registers. Returns -1 with an
+ * exception set on failure. */
+static inline int
+add_hash(HyperLogLog *self, uint32_t hash)
+{
+    uint32_t index;
+    uint32_t rank;
+    int status;
+
+    if (self->registers == NULL) {
+        if ((status = add_explicit(self, hash)) <= 0)
+            return status;
+    } else if (self->shares != NULL && own_registers(self) < 0) {
+        return -1;
+    }
+
+    index = hllIndex(hash, self->k);
+    rank = hllRank(hash, self->k);
+
+    /* A bulk write without the GIL may store to the same register. */
+    if (self->threadsafe || writing(self))
+        hllAtomicMax(&self->registers[index], rank);
+    else if (rank > self->registers[index])
+        self->registers[index] = rank;
+
+    return 0;
+}
+
+/* Adds an element to the cardinality estimator. */
+static PyObject *
+HyperLogLog_add(HyperLogLog *self, PyObject *key)
+{
+    const char *data;
+    Py_ssize_t dataLength;
+
+    if (!hllKeyData(key, &data, &dataLength))
+        return NULL;
+
+    if (add_hash(self, hllHash(self->hash, data, dataLength, self->seed)) < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+};
+
+/* Gets the bytes of every element of a list, which must stay alive while the
+ * items are used. Returns NULL with an exception set on failure. */
+static BatchItem *
+list_items(PyObject *list)
+{
+    Py_ssize_t i, n = PyList_GET_SIZE(list);
+    BatchItem *items;
+
+    items = (BatchItem *) malloc((n > 0 ? n : 1) * sizeof(BatchItem));
+    if (items == NULL)
+        return (BatchItem *) PyErr_NoMemory();
+
+    for (i = 0; i < n; i++) {
+        const char *data;
+        Py_ssize_t dataLength;
+
+        if (!hllKeyData(PyList_GET_ITEM(list, i), &data, &dataLength)) {
+            free(items);
+            return NULL;
+        }
+        items[i].data = data;
+        items[i].length = dataLength;
+    }
+
+    return items;
+}
+
+/* Adds n elements. Large batches are hashed and applied without the GIL,
+ * split across threads by register range. Returns -1 with an exception set
+ * on failure. */
+static int
+add_items(HyperLogLog *self, const BatchItem *items, Py_ssize_t n,
+          int threads)
+{
+    PyThreadState *state = NULL;
+    Py_ssize_t done = 0;
+    int status, nogil;
+
+    /* An explicit HyperLogLog takes elements until it converts, the rest go
+     * to the registers. */
+    while (self->registers == NULL && done < n) {
+        status = add_explicit(self, hllHash(self->hash, items[done].data,
+                                            items[done].length, self->seed));
+        if (status < 0)
+            return -1;
+        if (status == 0)
+            done++;
+    }
+
+    if (done == n)
+        return 0;
+
+    if (own_registers(self) < 0)
+        return -1;
+
+    /* The write begins before the GIL is released, so no reader sees the
+     * registers converted from the explicit set without the rest. Without
+     * the GIL other threads may add too, so the stores are atomic. */
+    nogil = n - done >= HLL_NOGIL_SIZE;
+    begin_write(self);
+    if (nogil)
+        state = PyEval_SaveThread();
+
+    hllAddBatch(self->registers, self->k, self->hash, self->seed,
+                items + done, n - done, threads, self->threadsafe || nogil);
+    end_write(self);
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    return 0;
+}
+
+/* Adds every element of an iterable. */
+static PyObject *
+HyperLogLog_add_many(HyperLogLog *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"iterable", "threads", NULL};
+    PyObject *iterable, *list;
+    BatchItem *items;
+    int threads = 1, status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+                                     &iterable, &threads))
+        return NULL;
+
+    if (threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "Threads must be at least 1.");
+        return NULL;
+    }
+
+    /* A private list keeps every element alive while the GIL is released. */
+    list = PySequence_List(iterable);
+    if (list == NULL)
+        return NULL;
+
+    items = list_items(list);
+    if (items == NULL) {
+        Py_DECREF(list);
+        return NULL;
+    }
+
+    status = add_items(self, items, PyList_GET_SIZE(list), threads);
+    free(items);
+    Py_DECREF(list);
+
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* A growable buffer compound keys are encoded in, see encode_fields(). It
+ * starts on the stack, so short keys need no allocation. */
 typedef struct {
-    PyObject_HEAD
-    short int k;      /* size = 2^k */
-    uint32_t seed;    /* Murmur3 seed */
-    uint32_t size;    /* number of registers */
-    char *registers __attribute__ ((aligned (8))); /* ranks */
-} HyperLogLog;
+    char *data;
+    size_t length;
+    size_t capacity;
+    char stack[HLL_KEY_STACK];
+} KeyBuffer;
+
+static void
+key_init(KeyBuffer *key)
+{
+    key->data = key->stack;
+    key->length = 0;
+    key->capacity = HLL_KEY_STACK;
+}
+
+static void
+key_free(KeyBuffer *key)
+{
+    if (key->data != key->stack)
+        free(key->data);
+}
+
+/* Makes room for n more bytes. Returns -1 with an exception set on failure.
+ */
+static int
+key_reserve(KeyBuffer *key, size_t n)
+{
+    size_t capacity = key->capacity;
+    char *data;
+
+    if (key->length + n <= capacity)
+        return 0;
+
+    while (capacity < key->length + n)
+        capacity *= 2;
+
+    if (key->data == key->stack) {
+        data = (char *) malloc(capacity);
+        if (data != NULL)
+            memcpy(data, key->stack, key->length);
+    } else {
+        data = (char *) realloc(key->data, capacity);
+    }
+    if (data == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    key->data = data;
+    key->capacity = capacity;
+    return 0;
+}
+
+/* Appends a type byte and the little endian length of a field. */
+static inline void
+key_header(KeyBuffer *key, char type, uint32_t length)
+{
+    char *p = key->data + key->length;
+
+    p[0] = type;
+    p[1] = (char) length;
+    p[2] = (char) (length >> 8);
+    p[3] = (char) (length >> 16);
+    p[4] = (char) (length >> 24);
+    key->length += 5;
+}
+
+/* Appends the fields of a tuple to key. Each field is a type byte, its
+ * length as 4 little endian bytes and its bytes, so ("ab", "c") and
+ * ("a", "bc") are different keys. str, as UTF-8, and bytes have type 's',
+ * ints have type 'i' and are 8 little endian bytes of two's complement.
+ * Returns -1 with an exception set on failure. */
+static int
+encode_fields(KeyBuffer *key, PyObject *fields)
+{
+    PyObject *seq, **items;
+    Py_ssize_t i, n;
+    int status = 0;
+
+    seq = PySequence_Fast(fields, "Expected a tuple of fields.");
+    if (seq == NULL)
+        return -1;
+
+    n = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+    for (i = 0; i < n && status == 0; i++) {
+        PyObject *field = items[i];
+        const char *data;
+        Py_ssize_t length;
+
+        #if PY_MAJOR_VERSION >= 3
+        if (PyLong_Check(field)) {
+        #else
+        if (PyLong_Check(field) || PyInt_Check(field)) {
+        #endif
+            uint64_t value = (uint64_t) PyLong_AsLongLong(field);
+            int j;
+
+            if (PyErr_Occurred() || key_reserve(key, 5 + 8) < 0) {
+                status = -1;
+                break;
+            }
+            key_header(key, 'i', 8);
+            for (j = 0; j < 8; j++)
+                key->data[key->length++] = (char) (value >> (8 * j));
+        } else if (hllKeyData(field, &data, &length)) {
+            if ((uint64_t) length > UINT32_MAX ||
+                key_reserve(key, 5 + length) < 0) {
+                if (!PyErr_Occurred())
+                    PyErr_SetString(PyExc_OverflowError, "Field too long.");
+                status = -1;
+                break;
+            }
+            key_header(key, 's', (uint32_t) length);
+            memcpy(key->data + key->length, data, length);
+            key->length += length;
+        } else {
+            PyErr_SetString(PyExc_TypeError,
+                            "Fields must be str, bytes or int.");
+            status = -1;
+        }
+    }
+
+    Py_DECREF(seq);
+    return status;
+}
+
+/* Adds a tuple of str, bytes and int fields as one element. */
+static PyObject *
+HyperLogLog_add_tuple(HyperLogLog *self, PyObject *fields)
+{
+    KeyBuffer key;
+    int status;
+
+    key_init(&key);
+    status = encode_fields(&key, fields);
+    if (status == 0)
+        status = add_hash(self, hllHash(self->hash, key.data, key.length,
+                                        self->seed));
+    key_free(&key);
+
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Adds every tuple of an iterable, see add_tuple(). The tuples are encoded
+ * one after another in one buffer and then added like add_many(). */
+static PyObject *
+HyperLogLog_add_tuples(HyperLogLog *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"iterable", "threads", NULL};
+    PyObject *iterable, *iterator, *fields;
+    BatchItem *items = NULL;
+    size_t *ends = NULL, capacity = 0;
+    Py_ssize_t i, n = 0;
+    KeyBuffer keys;
+    int threads = 1, status = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+                                     &iterable, &threads))
+        return NULL;
+
+    if (threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "Threads must be at least 1.");
+        return NULL;
+    }
+
+    if ((iterator = PyObject_GetIter(iterable)) == NULL)
+        return NULL;
+
+    key_init(&keys);
+    while (status == 0 && (fields = PyIter_Next(iterator)) != NULL) {
+        if ((size_t) n == capacity) {
+            size_t *grown;
+
+            capacity = capacity ? capacity * 2 : 1024;
+            grown = (size_t *) realloc(ends, capacity * sizeof(size_t));
+            if (grown == NULL) {
+                PyErr_NoMemory();
+                status = -1;
+            }
+            ends = grown ? grown : ends;
+        }
+        if (status == 0 && (status = encode_fields(&keys, fields)) == 0)
+            ends[n++] = keys.length;
+        Py_DECREF(fields);
+    }
+    Py_DECREF(iterator);
+
+    if (status == 0 && PyErr_Occurred())
+        status = -1;
+
+    /* Elements point into the buffer once it stops moving. */
+    if (status == 0) {
+        items = (BatchItem *) malloc((n > 0 ? n : 1) * sizeof(BatchItem));
+        if (items == NULL) {
+            PyErr_NoMemory();
+            status = -1;
+        }
+    }
+
+    if (status == 0) {
+        for (i = 0; i < n; i++) {
+            size_t start = i > 0 ? ends[i - 1] : 0;
+            items[i].data = keys.data + start;
+            items[i].length = ends[i] - start;
+        }
+        status = add_items(self, items, n, threads);
+    }
+
+    free(items);
+    free(ends);
+    key_free(&keys);
+
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Gets hash i of a buffer of 4 or 8 byte hashes. 8 byte hashes contribute
+ * their high half. */
+static inline uint32_t
+buffer_hash(const Py_buffer *view, Py_ssize_t i)
+{
+    if (view->itemsize == 4)
+        return ((const uint32_t *) view->buf)[i];
+
+    return (uint32_t) (((const uint64_t *) view->buf)[i] >> 32);
+}
+
+/* Adds hashes from a buffer of 4 or 8 byte unsigned integers, as returned by
+ * hash_many(). */
+static PyObject *
+HyperLogLog_add_hashes(HyperLogLog *self, PyObject *hashes)
+{
+    PyThreadState *state = NULL;
+    Py_buffer view;
+    Py_ssize_t i, n;
+    const char *format;
+    int status = 0;
+
+    if (PyObject_GetBuffer(hashes, &view,
+                           PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+        return NULL;
+
+    format = view.format ? view.format + strlen(view.format) - 1 : "I";
+    if ((view.itemsize != 4 && view.itemsize != 8) ||
+        strchr("iIlLqQ", *format) == NULL) {
+        PyBuffer_Release(&view);
+        char * msg = "Hashes must be 4 or 8 byte integers.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    if (view.itemsize == 8 && self->hash == HLL_HASH_MURMUR3) {
+        PyBuffer_Release(&view);
+        char * msg = "Murmur3 hashes are 4 bytes wide.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    n = view.len / view.itemsize;
+
+    /* An explicit HyperLogLog takes hashes until it converts. */
+    i = 0;
+    while (self->registers == NULL && i < n) {
+        if ((status = add_explicit(self, buffer_hash(&view, i))) < 0)
+            break;
+        if (status == 0)
+            i++;
+    }
+
+    if (status < 0 || (i < n && own_registers(self) < 0)) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    begin_write(self);
+    if (n - i >= HLL_NOGIL_SIZE)
+        state = PyEval_SaveThread();
+
+    for (; i < n; i++) {
+        uint32_t hash = buffer_hash(&view, i), index, rank;
+
+        index = hllIndex(hash, self->k);
+        rank = hllRank(hash, self->k);
+
+        /* Without the GIL other threads may add too. */
+        if (self->threadsafe || state != NULL)
+            hllAtomicMax(&self->registers[index], rank);
+        else if (rank > (uint8_t) self->registers[index])
+            self->registers[index] = rank;
+    }
+    end_write(self);
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    PyBuffer_Release(&view);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Parses an optional estimator name, defaulting to the corrected estimate. */
+static int
+parse_estimator(const char *name)
+{
+    int estimator;
+
+    if (name == NULL)
+        return HLL_ESTIMATOR_CORRECTED;
+
+    estimator = hllEstimatorFromName(name);
+    if (estimator < 0)
+        PyErr_Format(PyExc_ValueError, "Unknown estimator '%s'.", name);
+
+    return estimator;
+}
+
+/* Builds a list of register counts for ranks 0 to the largest possible rank,
+ * 32 - k + 1. */
+static PyObject *
+histogram_to_list(const uint32_t *counts, short int k)
+{
+    int i, n = 32 - k + 2;
+    PyObject *list = PyList_New(n);
+
+    if (list == NULL)
+        return NULL;
+
+    for (i = 0; i < n; i++) {
+        uint32_t count = counts[i];
+        if (i == n - 1) {
+            int j;
+            for (j = n; j < HLL_HISTOGRAM_SIZE; j++)
+                count += counts[j];
+        }
+        PyList_SET_ITEM(list, i, PyLong_FromUnsignedLong(count));
+    }
+
+    return list;
+}
+
+/* Gets a cardinality estimate, or the exact cardinality of an explicit
+ * HyperLogLog. */
+static PyObject *
+HyperLogLog_cardinality(HyperLogLog *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"estimator", NULL};
+    const char *name = NULL;
+    uint32_t counts[HLL_HISTOGRAM_SIZE], count;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &name))
+        return NULL;
+
+    if ((estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    if (self->registers == NULL && explicit_count(self, &count))
+        return Py_BuildValue("d", (double) count);
+
+    if (snapshot_histogram(self, counts) < 0)
+        return NULL;
+    return Py_BuildValue("d", hllEstimate(counts, self->k, estimator));
+}
+
+/* Gets a cardinality estimate with its standard error and a confidence
+ * interval, all from a single scan of the registers. The lower bound is never
+ * below the number of non-empty registers.
+ */
+static PyObject *
+HyperLogLog_cardinality_with_error(HyperLogLog *self, PyObject *args,
+                                   PyObject *kwds)
+{
+    static char *kwlist[] = {"estimator", "confidence", NULL};
+    const char *name = NULL;
+    double confidence = 0.95;
+    uint32_t counts[HLL_HISTOGRAM_SIZE], count;
+    double estimate, error, z, lower, upper;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|sd", kwlist,
+                                     &name, &confidence))
+        return NULL;
+
+    if ((estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    if (!(confidence > 0.0 && confidence < 1.0)) {
+        char * msg = "Confidence must be in the range (0, 1).";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    /* The cardinality of an explicit HyperLogLog is exact. */
+    if (self->registers == NULL && explicit_count(self, &count)) {
+        estimate = count;
+        return Py_BuildValue("(dddd)", estimate, 0.0, estimate, estimate);
+    }
+
+    if (snapshot_histogram(self, counts) < 0)
+        return NULL;
+    estimate = hllEstimate(counts, self->k, estimator);
+    error = hllStandardError(counts, self->k, estimator, estimate);
+    z = hllNormalQuantile(confidence);
+
+    lower = estimate - z * error;
+    if (lower < (double) (self->size - counts[0]))
+        lower = self->size - counts[0];
+    upper = estimate + z * error;
+
+    return Py_BuildValue("(dddd)", estimate, error, lower, upper);
+}
+
+/* Gets a cardinality estimate from a histogram returned by
+ * register_histogram(), so several estimators can share one register scan.
+ */
+static PyObject *
+HyperLogLog_estimate(HyperLogLog *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"histogram", "estimator", NULL};
+    PyObject *histogram, *seq;
+    const char *name = NULL;
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+    uint64_t total = 0;
+    Py_ssize_t i, n;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|s", kwlist,
+                                     &histogram, &name))
+        return NULL;
+
+    if ((estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    seq = PySequence_Fast(histogram, "Histogram must be a sequence.");
+    if (seq == NULL)
+        return NULL;
+
+    n = PySequence_Fast_GET_SIZE(seq);
+    if (n > HLL_HISTOGRAM_SIZE) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "Histogram has too many ranks.");
+        return NULL;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n; i++) {
+        unsigned long count;
+        count = PyLong_AsUnsignedLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (count == (unsigned long) -1 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+        counts[i] = (uint32_t) count;
+        total += count;
+    }
+    Py_DECREF(seq);
+
+    if (total != self->size) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Histogram counts must sum to the number of registers.");
+        return NULL;
+    }
+
+    return Py_BuildValue("d", hllEstimate(counts, self->k, estimator));
+}
+
+/* Gets the number of registers with each rank. */
+static PyObject *
+HyperLogLog_register_histogram(HyperLogLog *self)
+{
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+
+    if (snapshot_histogram(self, counts) < 0)
+        return NULL;
+    return histogram_to_list(counts, self->k);
+}
+
+/* Get a Murmur3 hash of a python string, buffer or bytes (python 3.x) as an
+ * unsigned integer.
+ */
+static PyObject *
+HyperLogLog_murmur3_hash(HyperLogLog *self, PyObject *key)
+{
+    const char *data;
+    Py_ssize_t dataLength;
+    uint32_t hash;
+
+    if (!hllKeyData(key, &data, &dataLength))
+        return NULL;
+
+    MurmurHash3_x86_32((void *) data, dataLength, self->seed, (void *) &hash);
+    return PyLong_FromUnsignedLong(hash);
+}
+
+/* Hashes count elements into hashes, 8 byte hashes get all 64 bits. Elements
+ * are either items or, if items is NULL, count records of size bytes at
+ * data. */
+static void
+hash_elements(HyperLogLog *self, const BatchItem *items, const char *data,
+              Py_ssize_t size, Py_ssize_t count, HashBuffer *hashes)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < count; i++) {
+        const void *element = items ? items[i].data : data + i * size;
+        size_t length = items ? items[i].length : (size_t) size;
+
+        if (hashes->width == 4)
+            ((uint32_t *) hashes->hashes)[i] =
+                hllHash(self->hash, element, length, self->seed);
+        else
+            ((uint64_t *) hashes->hashes)[i] =
+                hllHash64(self->hash, element, length, self->seed);
+    }
+}
+
+/* Hashes every element of an iterable, or every item of a buffer, with the
+ * HyperLogLog's hash and seed. Gets a buffer of unsigned integers. */
+static PyObject *
+HyperLogLog_hash_many(HyperLogLog *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"data", "bits", NULL};
+    PyObject *data, *list = NULL;
+    PyThreadState *state = NULL;
+    HashBuffer *hashes = NULL;
+    BatchItem *items = NULL;
+    Py_buffer view;
+    Py_ssize_t n;
+    int bits = 32;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+                                     &data, &bits))
+        return NULL;
+
+    if (bits != 32 && bits != 64) {
+        PyErr_SetString(PyExc_ValueError, "Bits must be 32 or 64.");
+        return NULL;
+    }
+
+    if (bits == 64 && self->hash == HLL_HASH_MURMUR3) {
+        char * msg = "Murmur3 hashes are 32 bits.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return NULL;
+    }
+
+    view.obj = NULL;
+    view.buf = NULL;
+    view.itemsize = 0;
+    if (PyObject_CheckBuffer(data)) {
+        if (PyObject_GetBuffer(data, &view, PyBUF_C_CONTIGUOUS) < 0)
+            return NULL;
+        n = view.itemsize > 0 ? view.len / view.itemsize : 0;
+    } else {
+        /* A private list keeps every element alive while the GIL is
+         * released. */
+        list = PySequence_List(data);
+        if (list == NULL)
+            return NULL;
+        n = PyList_GET_SIZE(list);
+        items = list_items(list);
+        if (items == NULL)
+            goto done;
+    }
+
+    hashes = hllHashBufferNew(n, bits / 8);
+    if (hashes == NULL)
+        goto done;
+
+    if (n >= HLL_NOGIL_SIZE)
+        state = PyEval_SaveThread();
+
+    hash_elements(self, items, (const char *) view.buf, view.itemsize, n,
+                  hashes);
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+done:
+    free(items);
+    Py_XDECREF(list);
+    if (view.obj != NULL)
+        PyBuffer_Release(&view);
+
+    return (PyObject *) hashes;
+}
+
+/* Gets the registers a bulk merge into self should write to. Thread safe
+ * HyperLogLogs, and any HyperLogLog when the merge releases the GIL, merge
+ * into zeroed scratch registers, which end_merge() merges atomically so
+ * concurrent adds are never lost. Returns NULL with an exception set on
+ * failure. */
+static char *
+begin_merge(HyperLogLog *self, int nogil)
+{
+    char *scratch;
+
+    if (own_registers(self) < 0)
+        return NULL;
+
+    if (!self->threadsafe && !nogil) {
+        begin_write(self);
+        return self->registers;
+    }
+
+    scratch = (char *) calloc(self->size, sizeof(char));
+    if (scratch == NULL)
+        PyErr_NoMemory();
+    else
+        begin_write(self);
+
+    return scratch;
+}
+
+/* Completes a merge started by begin_merge(), doesn't need the GIL. */
+static void
+end_merge(HyperLogLog *self, char *target)
+{
+    if (target != self->registers) {
+        hllMergeAtomic(self->registers, target, self->size);
+        free(target);
+    }
+    end_write(self);
+}
+
+/* Checks that hll is a HyperLogLog that can be merged into self. If fold is
+ * set hll may have more registers than self. */
+static int
+check_mergeable(HyperLogLog *self, PyObject *hll, int fold)
+{
+    if (!PyObject_TypeCheck(hll, &HyperLogLogType)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a HyperLogLog.");
+        return -1;
+    }
+
+    if (fold && ((HyperLogLog *) hll)->size < self->size) {
+        char * msg = "Cannot merge a HyperLogLog with fewer registers.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    if (!fold && ((HyperLogLog *) hll)->size != self->size) {
+        PyErr_SetString(PyExc_ValueError, "HyperLogLogs must be the same size");
+        return -1;
+    }
+
+    if (((HyperLogLog *) hll)->seed != self->seed) {
+        PyErr_SetString(PyExc_ValueError, "HyperLogLogs must use the same seed");
+        return -1;
+    }
+
+    if (((HyperLogLog *) hll)->hash != self->hash) {
+        PyErr_SetString(PyExc_ValueError, "HyperLogLogs must use the same hash");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Adds the hashes of explicit hll to explicit self, see merge_explicit(). */
+static int
+merge_explicit_sets(HyperLogLog *self, HyperLogLog *hll)
+{
+    switch (hllExplicitMerge(&self->small, &hll->small)) {
+    case HLL_EXPLICIT_NOMEM:
+        PyErr_NoMemory();
+        return -1;
+    case HLL_EXPLICIT_FULL:
+        return hllOwnRegisters(self) < 0 ? -1 : 1;
+    default:
+        return 0;
+    }
+}
+
+/* Adds the hashes of explicit hll to explicit self. Once the set is full, or
+ * if either converted in the meantime, self has registers and 1 is returned,
+ * the caller then merges the registers of hll. Both sets are locked while
+ * they are read and grown. Returns -1 with an exception set on failure. */
+static int
+merge_explicit(HyperLogLog *self, HyperLogLog *hll)
+{
+    int status;
+
+    Py_BEGIN_CRITICAL_SECTION2(self, hll);
+    if (self->registers != NULL)
+        status = 1;
+    else if (hll->registers != NULL)
+        status = hllOwnRegisters(self) < 0 ? -1 : 1;
+    else
+        status = merge_explicit_sets(self, hll);
+    Py_END_CRITICAL_SECTION2();
+
+    return status;
+}
+
+/* Merges hll into self, folding hll down if it has more registers. The union
+ * of two explicit HyperLogLogs stays explicit while it fits. Returns -1 with
+ * an exception set on failure. */
+static int
+merge_into(HyperLogLog *self, HyperLogLog *hll)
+{
+    PinnedRegisters other;
+    char *target;
+    int status, nogil;
+
+    if (self->registers == NULL && hll->registers == NULL &&
+        (status = merge_explicit(self, hll)) <= 0)
+        return status;
+
+    if (pin_registers(hll, &other) < 0)
+        return -1;
+
+    if (self->threadsafe && other.k == self->k) {
+        hllMergeAtomic(self->registers, other.registers, self->size);
+        unpin_registers(&other);
+        return 0;
+    }
+
+    nogil = ((size_t) 1 << other.k) >= HLL_NOGIL_SIZE;
+    if ((target = begin_merge(self, nogil)) == NULL) {
+        unpin_registers(&other);
+        return -1;
+    }
+
+    if (nogil) {
+        Py_BEGIN_ALLOW_THREADS
+        hllFold(target, self->k, other.registers, other.k);
+        end_merge(self, target);
+        Py_END_ALLOW_THREADS
+    } else {
+        hllFold(target, self->k, other.registers, other.k);
+        end_merge(self, target);
+    }
+
+    unpin_registers(&other);
+    return 0;
+}
+
+/* Merges another HyperLogLog into the current HyperLogLog. The registers of
+ * the other HyperLogLog are unaffected. A HyperLogLog with more registers is
+ * folded down to the size of the current one.
+ */ 
+static PyObject *
+HyperLogLog_merge(HyperLogLog *self, PyObject *hll) 
+{
+    if (check_mergeable(self, hll, 1) < 0)
+        return NULL;
+
+    if (merge_into(self, (HyperLogLog *) hll) < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+} 
+
+/* Unpins the registers of n HyperLogLogs, see collect_registers(), and
+ * frees the arrays holding them. Doesn't need the GIL. */
+static void
+free_registers(const char **registers, PinnedRegisters *pins, Py_ssize_t n)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < n; i++)
+        unpin_registers(&pins[i]);
+    free(pins);
+    free(registers);
+}
+
+/* Gets an array of the registers of every HyperLogLog in the sequence seq,
+ * which must all be the same size as self unless fold is set. The registers
+ * stay pinned, see pin_registers(), until free_registers(), and *pins holds
+ * their precisions. The array is only valid while seq is alive. Returns NULL
+ * with an exception set on failure.
+ */
+static const char **
+collect_registers(HyperLogLog *self, PyObject *seq, int fold,
+                  PinnedRegisters **pins)
+{
+    Py_ssize_t i, n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    const char **others;
+
+    others = (const char **) malloc((n > 0 ? n : 1) * sizeof(char *));
+    *pins = (PinnedRegisters *) malloc((n > 0 ? n : 1) *
+                                       sizeof(PinnedRegisters));
+    if (others == NULL || *pins == NULL) {
+        free(others);
+        free(*pins);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (check_mergeable(self, items[i], fold) < 0 ||
+            pin_registers((HyperLogLog *) items[i], &(*pins)[i]) < 0) {
+            free_registers(others, *pins, i);
+            return NULL;
+        }
+        others[i] = (*pins)[i].registers;
+    }
+
+    return others;
+}
+
+/* Merges every HyperLogLog in the sequence seq into self, splitting the
+ * registers across threads. HyperLogLogs with more registers than self are
+ * folded down. Returns -1 with an exception set on failure. */
+static int
+merge_sequence(HyperLogLog *self, PyObject *seq, int threads)
+{
+    Py_ssize_t i, n = PySequence_Fast_GET_SIZE(seq), same = 0;
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    PyThreadState *state = NULL;
+    const char **others, **registers;
+    PinnedRegisters *pins;
+    char *target;
+    int nogil;
+
+    if (threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "Threads must be at least 1.");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (check_mergeable(self, items[i], 1) < 0)
+            return -1;
+    }
+
+    /* The union of explicit HyperLogLogs stays explicit while it fits. */
+    for (i = 0; i < n && self->registers == NULL; i++) {
+        HyperLogLog *hll = (HyperLogLog *) items[i];
+
+        if ((hll->registers == NULL ? merge_explicit(self, hll)
+                                    : own_registers(self)) < 0)
+            return -1;
+    }
+    if (self->registers == NULL)
+        return 0;
+
+    if ((registers = collect_registers(self, seq, 1, &pins)) == NULL)
+        return -1;
+
+    others = (const char **) malloc((n > 0 ? n : 1) * sizeof(char *));
+    if (others == NULL) {
+        free_registers(registers, pins, n);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (pins[i].k == self->k)
+            others[same++] = registers[i];
+    }
+
+    nogil = (uint64_t) n * self->size >= HLL_NOGIL_SIZE;
+    if ((target = begin_merge(self, nogil)) == NULL) {
+        free(others);
+        free_registers(registers, pins, n);
+        return -1;
+    }
+
+    /* seq holds references to the inputs while the GIL is released. */
+    if (nogil)
+        state = PyEval_SaveThread();
+
+    hllMergeMany(target, others, same, self->size, threads);
+    for (i = 0; i < n; i++) {
+        if (pins[i].k != self->k)
+            hllFold(target, self->k, registers[i], pins[i].k);
+    }
+    end_merge(self, target);
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    free(others);
+    free_registers(registers, pins, n);
+    return 0;
+}
+
+/* Creates a HyperLogLog whose registers are the first 2^k bytes of a
+ * writable buffer, such as shared memory. Registers in the buffer are kept, so
+ * processes sharing the buffer all update the same sketch. Updates are
+ * atomic. */
+static PyObject *
+HyperLogLog_from_buffer(PyObject *cls, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"buffer", "k", "seed", "hash", NULL};
+    PyObject *buffer;
+    HyperLogLog *hll;
+    uint32_t seed = 314;
+    const char *hash = "murmur3";
+    int k;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oi|Is", kwlist,
+                                     &buffer, &k, &seed, &hash))
+        return NULL;
+
+    hll = (HyperLogLog *) PyObject_CallFunction(cls, "iIis", k, seed, 1, hash);
+    if (hll == NULL)
+        return NULL;
+
+    if (PyObject_GetBuffer(buffer, &hll->shared, PyBUF_WRITABLE) < 0) {
+        Py_DECREF(hll);
+        return NULL;
+    }
+
+    if (hll->shared.len < (Py_ssize_t) hll->size) {
+        char * msg = "Buffer must hold at least 2^k bytes.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        PyBuffer_Release(&hll->shared);
+        Py_DECREF(hll);
+        return NULL;
+    }
+
+    free(hll->registers);
+    hll->registers = (char *) hll->shared.buf;
+    hll->threadsafe = 1;
+
+    return (PyObject *) hll;
+}
+
+/* Creates a new HyperLogLog from the union of an iterable of HyperLogLogs
+ * with the same seed. The union has the size of the smallest HyperLogLog,
+ * larger ones are folded down. */
+static PyObject *
+HyperLogLog_union(PyObject *cls, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"hlls", "threads", NULL};
+    PyObject *iterable, *seq, *result;
+    HyperLogLog *first;
+    Py_ssize_t i;
+    int threads = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+                                     &iterable, &threads))
+        return NULL;
+
+    seq = PySequence_Fast(iterable, "Expected an iterable of HyperLogLogs.");
+    if (seq == NULL)
+        return NULL;
+
+    if (PySequence_Fast_GET_SIZE(seq) == 0) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "Union of no HyperLogLogs.");
+        return NULL;
+    }
+
+    /* The union has the size of the smallest HyperLogLog. */
+    first = NULL;
+    for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        HyperLogLog *hll = (HyperLogLog *) PySequence_Fast_GET_ITEM(seq, i);
+        if (!PyObject_TypeCheck((PyObject *) hll, &HyperLogLogType)) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_TypeError, "Expected a HyperLogLog.");
+            return NULL;
+        }
+        if (first == NULL || hll->k < first->k)
+            first = hll;
+    }
+
+    result = PyObject_CallFunction(cls, "iI", first->k, first->seed);
+    if (result == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+    ((HyperLogLog *) result)->hash = first->hash;
+
+    if (merge_sequence((HyperLogLog *) result, seq, threads) < 0) {
+        Py_DECREF(result);
+        result = NULL;
+    }
+
+    Py_DECREF(seq);
+    return result;
+}
+
+/* Gets a cardinality estimate of the union of an iterable of HyperLogLogs
+ * with the same size and seed. The union is never materialized, its
+ * registers are counted block by block as they are computed.
+ */
+static PyObject *
+HyperLogLog_union_cardinality(PyObject *cls, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"hlls", "estimator", NULL};
+    PyObject *iterable, *seq;
+    HyperLogLog *first;
+    const char *name = NULL;
+    const char **registers;
+    PinnedRegisters *pins;
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+    Py_ssize_t n;
+    int estimator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|s", kwlist,
+                                     &iterable, &name))
+        return NULL;
+
+    if ((estimator = parse_estimator(name)) < 0)
+        return NULL;
+
+    seq = PySequence_Fast(iterable, "Expected an iterable of HyperLogLogs.");
+    if (seq == NULL)
+        return NULL;
+
+    n = PySequence_Fast_GET_SIZE(seq);
+    if (n == 0) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "Union of no HyperLogLogs.");
+        return NULL;
+    }
+
+    first = (HyperLogLog *) PySequence_Fast_GET_ITEM(seq, 0);
+    if (!PyObject_TypeCheck((PyObject *) first, &HyperLogLogType)) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_TypeError, "Expected a HyperLogLog.");
+        return NULL;
+    }
+
+    if ((registers = collect_registers(first, seq, 0, &pins)) == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    if ((uint64_t) n * first->size >= HLL_NOGIL_SIZE) {
+        Py_BEGIN_ALLOW_THREADS
+        hllUnionHistogram(registers, n, first->size, counts);
+        Py_END_ALLOW_THREADS
+    } else {
+        hllUnionHistogram(registers, n, first->size, counts);
+    }
+
+    free_registers(registers, pins, n);
+    Py_DECREF(seq);
+
+    return Py_BuildValue("d", hllEstimate(counts, first->k, estimator));
+}
+
+/* Estimates |A \ B|, |B \ A| and |A & B| for two HyperLogLogs passed in
+ * args with one pass over both register arrays. Returns -1 with an exception
+ * set on failure. */
+static int
+joint_estimate(PyObject *args, double *estimates)
+{
+    HyperLogLog *a, *b;
+    JointHistogram joint;
+    const char *first, *second;
+    char *tempA, *tempB = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!O!", &HyperLogLogType, &a,
+                          &HyperLogLogType, &b))
+        return -1;
+
+    if (check_mergeable(a, (PyObject *) b, 0) < 0)
+        return -1;
+
+    if ((first = read_registers(a, &tempA)) == NULL ||
+        (second = read_registers(b, &tempB)) == NULL) {
+        free(tempA);
+        return -1;
+    }
 
-typedef struct {
-    double distance;
-    uint32_t index;
-} Neighbour;
+    hllJointHistogram(first, second, a->size, &joint);
+    hllJointEstimate(&joint, a->k, estimates);
+    free(tempA);
+    free(tempB);
+    return 0;
+}
 
-static void
-HyperLogLog_dealloc(HyperLogLog* self)
+/* Gets a cardinality estimate of the intersection of two HyperLogLogs. */
+static PyObject *
+HyperLogLog_intersection_cardinality(PyObject *cls, PyObject *args)
 {
-    free(self->registers);
-    #if PY_MAJOR_VERSION >= 3
-    Py_TYPE(self)->tp_free((PyObject*) self);
-    #else
-    self->ob_type->tp_free((PyObject*) self);
-    #endif
+    double estimates[3];
+
+    if (joint_estimate(args, estimates) < 0)
+        return NULL;
+
+    return Py_BuildValue("d", estimates[2]);
 }
 
+/* Gets an estimate of the Jaccard index of two HyperLogLogs, the size of
+ * their intersection over the size of their union. */
 static PyObject *
-HyperLogLog_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+HyperLogLog_jaccard(PyObject *cls, PyObject *args)
 {
-    HyperLogLog *self;
-    self = (HyperLogLog *)type->tp_alloc(type, 0);
-    self->seed = 314;
-    return (PyObject *)self;
+    double estimates[3], total;
+
+    if (joint_estimate(args, estimates) < 0)
+        return NULL;
+
+    total = estimates[0] + estimates[1] + estimates[2];
+    return Py_BuildValue("d", total > 0.0 ? estimates[2] / total : 0.0);
+}
+
+/* Merges an iterable of HyperLogLogs into the current HyperLogLog. */
+static PyObject *
+HyperLogLog_union_into(HyperLogLog *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"hlls", "threads", NULL};
+    PyObject *iterable, *seq;
+    int threads = 1, status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+                                     &iterable, &threads))
+        return NULL;
+
+    seq = PySequence_Fast(iterable, "Expected an iterable of HyperLogLogs.");
+    if (seq == NULL)
+        return NULL;
+
+    status = merge_sequence(self, seq, threads);
+    Py_DECREF(seq);
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
+/* Folds the registers of self down to 2^k, see reduce_precision(). Returns
+ * -1 with an exception set on failure. */
 static int
-HyperLogLog_init(HyperLogLog *self, PyObject *args, PyObject *kwds)
-{ 
-    static char *kwlist[] = {"k", "seed", NULL};
+resize_registers(HyperLogLog *self, short int k)
+{
+    char *registers;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|i", kwlist, 
-				      &self->k, &self->seed)) {
-        return -1; 
+    if (k < 2 || k > self->k) {
+        char * msg = "Precision must be in the range [2, k].";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
     }
 
-    if (self->k < 2 || self->k > 16) {
-        char * msg = "Number of registers must be in the range [2^2, 2^16]";
+    if (self->shared.obj != NULL) {
+        char * msg = "Registers in a buffer cannot be resized.";
         PyErr_SetString(PyExc_ValueError, msg);
-	return -1;
-    } 
+        return -1;
+    }
 
-    self->size = 1 << self->k;
-    self->registers = (char *) malloc(self->size * sizeof(char));
-    memset(self->registers, 0, self->size);
+    /* The drain thread of an ingestor indexes the registers with k. */
+    if (__atomic_load_n(&self->ingestors, __ATOMIC_ACQUIRE) > 0) {
+        char * msg = "Registers fed by an AsyncIngestor cannot be resized.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
 
-    return 0; 
-}
+    /* Bulk writes and merges use the registers without the GIL. */
+    if (__atomic_load_n(&self->pins, __ATOMIC_ACQUIRE) > 0 || writing(self)) {
+        char * msg = "Registers in use by another thread cannot be resized.";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
 
-static PyMemberDef HyperLogLog_members[] = { 
-    {NULL} /* Sentinel */
-};
+    /* The hashes of an explicit HyperLogLog don't depend on k. */
+    if (self->registers == NULL && self->small.count <= hllExplicitLimit(k)) {
+        self->small.limit = hllExplicitLimit(k);
+        self->k = k;
+        self->size = 1 << k;
+        return 0;
+    }
 
-/* Adds an element to the cardinality estimator. */
+    if (hllOwnRegisters(self) < 0)
+        return -1;
+
+    registers = (char *) calloc(1 << k, sizeof(char));
+    if (registers == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    hllFold(registers, k, self->registers, self->k);
+    release_registers(self);
+    self->registers = registers;
+    self->k = k;
+    self->size = 1 << k;
+
+    return 0;
+}
+
+/* Reduces the number of registers to 2^k by folding the registers. The
+ * registers are replaced in a critical section, so no other thread converts,
+ * unshares or snapshots them meanwhile. */
 static PyObject *
-HyperLogLog_add(HyperLogLog *self, PyObject *args)
+HyperLogLog_reduce_precision(HyperLogLog *self, PyObject *args)
 {
-    const char *data;
-    const uint32_t dataLength;
+    short int k;
+    int status;
 
-    if (!PyArg_ParseTuple(args, "s#", &data, &dataLength))
+    if (!PyArg_ParseTuple(args, "h", &k))
         return NULL;
 
-    uint32_t hash;
-    uint32_t index;
-    uint32_t rank;
-
-    MurmurHash3_x86_32((void *) data, dataLength, self->seed, (void *) &hash);
-
-    /* Use the first k bits as a zero based index */
-    index = (hash >> (32 - self->k));
+    Py_BEGIN_CRITICAL_SECTION(self);
+    status = resize_registers(self, k);
+    Py_END_CRITICAL_SECTION();
 
-    /* Compute the rank, lzc + 1, of the remaining 32 - k bits */
-    rank = leadingZeroCount((hash << self->k) >> self->k) - self->k + 1;
-    
-    if (rank > self->registers[index])
-        self->registers[index] = rank;
+    if (status < 0)
+        return NULL;
 
     Py_INCREF(Py_None);
     return Py_None;
-};
+}
 
-/* shellsort: sorts v[0] ... v[n-1] in ascending order */
-void shellsort (Neighbour v[MAX_ARRAY_LENGTH], int n)
+/* Adds the hashes of an explicit set serialized by hllExplicitEncode(), so
+ * an explicit HyperLogLog stays exact. Returns -1 with an exception set on
+ * failure. */
+static int
+merge_explicit_bytes(HyperLogLog *self, const char *data, Py_ssize_t length)
 {
-    int gap, i, j;
-    Neighbour temp;
-    for (gap = n/2; gap > 0; gap /= 2)
-        for (i = gap; i < n; i++)
-            for (j = i - gap;
-                j >= 0 && v[j].distance > v[j + gap].distance; j -= gap) {
-
-                temp = v[j];
-                v[j] = v[j + gap];
-                v[j + gap] = temp;
-            }
-}
+    Py_ssize_t i;
 
-double estimate_bias(double E, short int k) {
-    static Neighbour neighbours[MAX_ARRAY_LENGTH];
-    uint32_t i;
-    double x;
-    const double *raw_estimate_data = rawEstimateData[k - 4];
-    uint32_t n = arrayLengths[k - 4];
+    if (length < 1 || data[0] != HLL_EXPLICIT_BYTE || (length - 1) % 4 != 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid serialized hashes.");
+        return -1;
+    }
 
-    for (i = 0; i < n; i++) {
-        x = E - raw_estimate_data[i];
-        neighbours[i].index = i;
-        neighbours[i].distance = x * x;
-    }
-    shellsort(neighbours, n);
-
-    const double *bias_data = biasData[k - 4];
-    double sum = 0.0;
-    for (i = 0; i < KNN_COUNT; i++) {
-        sum += bias_data[neighbours[i].index];
-    }
-
-    return sum / KNN_COUNT;
-}
-
-static double
-correct_estimate(HyperLogLog *self) {
-    double alpha = 0.0;
-    switch (self->size) {
-      case 16:
-      	  alpha = 0.673;
-	      break;
-      case 32:
-	      alpha = 0.697;
-	      break;
-      case 64:
-	      alpha = 0.709;
-	      break;
-      default:
-	      alpha = 0.7213/(1.0 + 1.079/(double) self->size);
-          break;
-    }
-
-    uint32_t i;
-    double rank;
-    double sum = 0.0;
-    for (i = 0; i < self->size; i++) {
-        rank = (double) self->registers[i];
-        sum = sum + pow(2, -1*rank);
+    for (i = 1; i < length; i += 4) {
+        if (add_hash(self, hllExplicitDecode(data + i)) < 0)
+            return -1;
     }
 
-    double E =  alpha * self->size * self->size / sum;
-    return E <= 5 * self->size ? E - estimate_bias(E, self->k) : E;
+    return 0;
 }
 
+/* Merges serialized registers into self. The buffer holds registers as
+ * returned by registers() or as pickled by __reduce__(), for a HyperLogLog
+ * with the same seed and at least as many registers, or the hashes pickled
+ * for an explicit HyperLogLog. Returns -1 with an exception set on failure.
+ */
+static int
+merge_buffer(HyperLogLog *self, Py_buffer *buffer)
+{
+    Py_ssize_t length = buffer->len;
+    short int k = 0;
+    char *decoded, *target;
 
-/* Compute SUM(2^-reg) in the dense representation.
- * PE is an array with a pre-computer table of values 2^-reg indexed by reg.
- * As a side effect the integer pointed by 'ezp' is set to the number
- * of zero registers. */
-double hllDenseSum(char *registers, uint32_t size, double *PE, int *ezp) {
-    double E = 0;
-    int j, ez = 0;
+    if (length > 0 && ((const char *) buffer->buf)[0] == HLL_EXPLICIT_BYTE)
+        return merge_explicit_bytes(self, (const char *) buffer->buf, length);
 
-    for (j = 0; j < size; j++) {
-            unsigned long reg = registers[j];
+    while (k < 31 && ((Py_ssize_t) 1 << k) < length)
+        k++;
 
-            if (reg == 0) {
-                ez++;
-                /* Increment E at the end of the loop. */
-            } else {
-                E += PE[reg]; /* Precomputed 2^(-reg[j]). */
-            }
+    if (((Py_ssize_t) 1 << k) != length || k < self->k) {
+        char * msg = "Registers must be a power of 2 no smaller than size().";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
     }
-    E += ez; /* Add 2^0 'ez' times. */
 
-    *ezp = ez;
-    return E;
-}
+    if (k == self->k && !self->threadsafe) {
+        if (own_registers(self) < 0)
+            return -1;
+        begin_write(self);
+        hllMergeEncoded(self->registers, (const char *) buffer->buf,
+                        self->size);
+        end_write(self);
+        return 0;
+    }
+
+    decoded = (char *) malloc(length);
+    if (decoded == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if ((target = begin_merge(self, 0)) == NULL) {
+        free(decoded);
+        return -1;
+    }
 
+    hllDecode(decoded, (const char *) buffer->buf, (uint32_t) length);
+    hllFold(target, self->k, decoded, k);
+    end_merge(self, target);
+    free(decoded);
+
+    return 0;
+}
 
-/* Gets a cardinality estimate. */
+/* Merges serialized registers into the current HyperLogLog. */
 static PyObject *
-HyperLogLog_cardinality(HyperLogLog *self)
+HyperLogLog_merge_bytes(HyperLogLog *self, PyObject *registers)
 {
-    double E, alpha = 0.7213/(1+1.079/self->size);
-    uint32_t m = self->size;
-    int j, ez; /* Number of registers equal to 0. */
+    Py_buffer buffer;
+    int status;
 
-    /* We precompute 2^(-reg[j]) in a small table in order to
-     * speedup the computation of SUM(2^-register[0..i]). */
-    static int initialized = 0;
-    static double PE[64];
-    if (!initialized) {
-        PE[0] = 1; /* 2^(-reg[j]) is 1 when m is 0. */
-        for (j = 1; j < 64; j++) {
-            /* 2^(-reg[j]) is the same as 1/2^reg[j]. */
-            PE[j] = 1.0/(1ULL << j);
-        }
-        initialized = 1;
-    }
+    if (!PyArg_Parse(registers, "s*", &buffer))
+        return NULL;
+
+    status = merge_buffer(self, &buffer);
+    PyBuffer_Release(&buffer);
+    if (status < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
 
-    /* Compute SUM(2^-register[0..i]). */
-    E = hllDenseSum(self->registers,m,PE,&ez);
+/* Merges an iterable of serialized registers into the current HyperLogLog. */
+static PyObject *
+HyperLogLog_merge_bytes_many(HyperLogLog *self, PyObject *iterable)
+{
+    PyObject *iterator, *item;
+    Py_buffer buffer;
+    int status = 0;
 
-    /* Muliply the inverse of E for alpha_m * m^2 to have the raw estimate. */
-    E = (1/E)*alpha*m*m;
+    if ((iterator = PyObject_GetIter(iterable)) == NULL)
+        return NULL;
 
-    /* Use the LINEARCOUNTING algorithm for small cardinalities.
-     * For larger values but up to 72000 HyperLogLog raw approximation is
-     * used since linear counting error starts to increase. However HyperLogLog
-     * shows a strong bias in the range 2.5*16384 - 72000, so we try to
-     * compensate for it. */
-    if (E < m*2.5 && ez != 0) {
-        E = m*log(m/ez); /* LINEARCOUNTING() */
-    } else if (m == 16384 && E < 72000) {
-        /* We did polynomial regression of the bias for this range, this
-         * way we can compute the bias for a given cardinality and correct
-         * according to it. Only apply the correction for P=14 that's what
-         * we use and the value the correction was verified with. */
-        double bias = 5.9119*1.0e-18*(E*E*E*E)
-                      -1.4253*1.0e-12*(E*E*E)+
-                      1.2940*1.0e-7*(E*E)
-                      -5.2921*1.0e-3*E+
-                      83.3216;
-        E -= E*(bias/100);
+    while (status == 0 && (item = PyIter_Next(iterator)) != NULL) {
+        /* Accept the same types as merge_bytes(). */
+        if (PyArg_Parse(item, "s*", &buffer)) {
+            status = merge_buffer(self, &buffer);
+            PyBuffer_Release(&buffer);
+        } else {
+            status = -1;
+        }
+        Py_DECREF(item);
     }
+    Py_DECREF(iterator);
+
+    if (status < 0 || PyErr_Occurred())
+        return NULL;
 
-    /* We don't apply the correction for E > 1/30 of 2^32 since we use
-     * a 64 bit function and 6 bit counters. To apply the correction for
-     * 1/30 of 2^64 is not needed since it would require a huge set
-     * to approach such a value. */
-    return Py_BuildValue("d", E);
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
+/* Allocates a HyperLogLog with the parameters of self and no registers. */
+static HyperLogLog *
+alloc_like(HyperLogLog *self)
+{
+    HyperLogLog *hll;
+
+    hll = (HyperLogLog *) Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
+    if (hll == NULL)
+        return NULL;
 
+    hll->k = self->k;
+    hll->seed = self->seed;
+    hll->size = self->size;
+    hll->threadsafe = self->threadsafe;
+    hll->hash = self->hash;
+    return hll;
+}
 
-/* Gets a cardinality estimate. */
+/* Gets a copy of the HyperLogLog with its own registers. */
 static PyObject *
-HyperLogLog_cardinality2(HyperLogLog *self)
+HyperLogLog_copy(HyperLogLog *self)
 {
-    uint32_t zeros = 0;
-    uint32_t i;
+    HyperLogLog *hll = alloc_like(self);
+    int status = 1;
 
-    for (i = 0; i < self->size; i++) {
-        if (self->registers[i] == 0) {
-            zeros += 1;
+    if (hll == NULL)
+        return NULL;
+
+    /* The set is copied in a critical section, as another thread may be
+     * growing or converting it. */
+    if (self->registers == NULL) {
+        Py_BEGIN_CRITICAL_SECTION(self);
+        if (self->registers == NULL)
+            status = hllExplicitCopy(&hll->small, &self->small);
+        Py_END_CRITICAL_SECTION();
+
+        if (status < 0) {
+            Py_DECREF(hll);
+            return PyErr_NoMemory();
         }
+        if (status == 0)
+            return (PyObject *) hll;
     }
 
-    double estimate;
-    if (zeros > 0) {
-        estimate = self->size * log(self->size / (double)zeros);
-        estimate = estimate <= tresholdData[self->k - 4] ? estimate :
-         correct_estimate(self);
-    } else {
-        estimate = correct_estimate(self);
+    hll->registers = (char *) malloc(self->size * sizeof(char));
+    if (hll->registers == NULL) {
+        Py_DECREF(hll);
+        return PyErr_NoMemory();
     }
 
-    return Py_BuildValue("d", estimate);
+    snapshot_registers(self, hll->registers);
+    return (PyObject *) hll;
 }
 
-/* Get a Murmur3 hash of a python string, buffer or bytes (python 3.x) as an
- * unsigned integer.
- */
+/* Copies the HyperLogLog for copy.deepcopy(), registers are never shared. */
 static PyObject *
-HyperLogLog_murmur3_hash(HyperLogLog *self, PyObject *args)
+HyperLogLog_deepcopy(HyperLogLog *self, PyObject *memo)
 {
-    const char *data;
-    const uint32_t dataLength;
+    return HyperLogLog_copy(self);
+}
 
-    if (!PyArg_ParseTuple(args, "s#", &data, &dataLength))
-        return NULL;
+/* Gives hll a share of the registers of self, in a critical section on self
+ * so another thread can't unshare or resize them meanwhile. Registers pinned
+ * by a merge without a share of their own aren't shared, as copying them
+ * later would free them under the merge. Returns 1 if they were shared, 0 if
+ * hll needs a copy, or -1 with an exception set on failure. */
+static int
+share_registers(HyperLogLog *self, HyperLogLog *hll)
+{
+    if (self->shares == NULL &&
+        __atomic_load_n(&self->pins, __ATOMIC_ACQUIRE) > 0)
+        return 0;
+
+    if (self->shares == NULL) {
+        self->shares = (uint32_t *) malloc(sizeof(uint32_t));
+        if (self->shares == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        *self->shares = 1;
+    }
 
-    uint32_t *hash = (uint32_t *) malloc(sizeof(uint32_t));
-    MurmurHash3_x86_32((void *) data, dataLength, self->seed, (void *) hash);
-    return Py_BuildValue("i", *hash);
+    __atomic_fetch_add(self->shares, 1, __ATOMIC_RELAXED);
+    hll->k = self->k;
+    hll->size = self->size;
+    hll->shares = self->shares;
+    hll->registers = self->registers;
+    return 1;
 }
 
-/* Merges another HyperLogLog into the current HyperLogLog. The registers of
- * the other HyperLogLog are unaffected. 
- */ 
+/* Gets a copy of the HyperLogLog that shares the registers until either
+ * copy modifies them. Registers that other threads, processes or ingestors
+ * may write without the GIL, and explicit hashes, are copied right away.
+ */
 static PyObject *
-HyperLogLog_merge(HyperLogLog *self, PyObject * args) 
+HyperLogLog_snapshot(HyperLogLog *self)
 {
-    PyObject *hll;
-    if (!PyArg_ParseTuple(args, "O", &hll)) //TODO: use O! to check type
-        return NULL;
+    HyperLogLog *hll;
+    int status;
 
-    PyObject *size = PyObject_CallMethod(hll, "size", NULL);
+    if (self->registers == NULL || self->threadsafe ||
+        self->shared.obj != NULL ||
+        __atomic_load_n(&self->ingestors, __ATOMIC_ACQUIRE) || writing(self))
+        return HyperLogLog_copy(self);
 
-    #if PY_MAJOR_VERSION >= 3
-    long hllSize = PyLong_AsLong(size);
-    #else
-    long hllSize = PyInt_AS_LONG(size);
-    #endif
-
-    if (hllSize != self->size) {
-        PyErr_SetString(PyExc_ValueError, "HyperLogLogs must be the same size");
+    if ((hll = alloc_like(self)) == NULL)
         return NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    status = share_registers(self, hll);
+    Py_END_CRITICAL_SECTION();
+
+    if (status <= 0) {
+        Py_DECREF(hll);
+        return status < 0 ? NULL : HyperLogLog_copy(self);
     }
-    Py_DECREF(size);
 
-    PyObject *hllByteArray = PyObject_CallMethod(hll, "registers", NULL);
-    char *hllRegisters = PyByteArray_AsString(hllByteArray);
+    return (PyObject *) hll;
+}
 
-    uint32_t i;
-    for (i = 0; i < self->size; i++) {
-        if (self->registers[i] < hllRegisters[i])
-	        self->registers[i] = hllRegisters[i];
+/* Serializes the hashes of an explicit HyperLogLog into *out, which the
+ * caller frees, in a critical section as another thread may be growing or
+ * converting them. *out stays NULL if self has registers by then. Returns -1
+ * with an exception set on failure. */
+static int
+encode_explicit(HyperLogLog *self, char **out, size_t *length)
+{
+    int status = 0;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->registers == NULL) {
+        *out = (char *) malloc(1 + (size_t) self->small.count * 4);
+        if (*out == NULL) {
+            PyErr_NoMemory();
+            status = -1;
+        } else {
+            *length = hllExplicitEncode(&self->small, *out);
+        }
     }
-    Py_DECREF(hllByteArray);
+    Py_END_CRITICAL_SECTION();
 
-    Py_INCREF(Py_None);
-    return Py_None;
-} 
+    return status;
+}
 
 /* Support for pickling, called when HyperLogLog is serialized. */
 static PyObject *
 HyperLogLog_reduce(HyperLogLog *self)
 {
+    PyObject *args, *state;
+    char *arr;
+    size_t length;
+    int i;
 
-    char *arr = (char *) malloc(self->size * sizeof(char));
+    /* The hash is only recorded when it isn't the default Murmur3, so those
+     * pickles still load in versions without pluggable hashes. */
+    if (self->hash == HLL_HASH_MURMUR3)
+        args = Py_BuildValue("(iIi)", self->k, self->seed, self->threadsafe);
+    else
+        args = Py_BuildValue("(iIis)", self->k, self->seed, self->threadsafe,
+                             hllHashName(self->hash));
+    if (args == NULL)
+        return NULL;
 
-    /* Pickle protocol 2, used in python 2.x, doesn't allow null bytes in
-     * strings and does not support pickling bytearrays. For backwards
-     * compatibility, we set all null bytes to 'z' before pickling.
-     */
-    int i;
-    for (i = 0; i < self->size; i++) {
-        if (self->registers[i] == 0) {
-            arr[i] = 'z';
-        } else {
-            arr[i] = self->registers[i];
+    /* An explicit HyperLogLog pickles its hashes so it stays exact. */
+    arr = NULL;
+    if (self->registers == NULL &&
+        encode_explicit(self, &arr, &length) < 0) {
+        Py_DECREF(args);
+        return NULL;
+    }
+
+    if (arr != NULL) {
+        #if PY_MAJOR_VERSION >= 3
+        state = Py_BuildValue("y#", arr, (Py_ssize_t) length);
+        #else
+        state = Py_BuildValue("s#", arr, (Py_ssize_t) length);
+        #endif
+    } else {
+        arr = (char *) malloc(self->size * sizeof(char));
+        if (arr == NULL) {
+            Py_DECREF(args);
+            return PyErr_NoMemory();
+        }
+
+        snapshot_registers(self, arr);
+
+        /* Pickle protocol 2, used in python 2.x, doesn't allow null bytes in
+         * strings and does not support pickling bytearrays. For backwards
+         * compatibility, we set all null bytes to 'z' before pickling.
+         */
+        for (i = 0; i < self->size; i++) {
+            if (arr[i] == 0)
+                arr[i] = HLL_ZERO_BYTE;
         }
+
+        state = Py_BuildValue("s#", arr, (Py_ssize_t) self->size);
+    }
+    free(arr);
+
+    if (state == NULL) {
+        Py_DECREF(args);
+        return NULL;
     }
 
-    PyObject *args = Py_BuildValue("(ii)", self->k, self->seed);
-    PyObject *registers = Py_BuildValue("s#", arr, self->size);
-    return Py_BuildValue("(OOO)", Py_TYPE(self), args, registers);
+    return Py_BuildValue("(ONN)", Py_TYPE(self), args, state);
 }
 
 /* Gets a copy of the registers as a bytesarray. */
@@ -356,7 +2129,9 @@ static PyObject *
 HyperLogLog_registers(HyperLogLog *self)
 {
     PyObject *registers;
-    registers = PyByteArray_FromStringAndSize(self->registers, self->size);
+    registers = PyByteArray_FromStringAndSize(NULL, self->size);
+    if (registers != NULL)
+        snapshot_registers(self, PyByteArray_AS_STRING(registers));
     return registers;
 }
 
@@ -395,6 +2170,9 @@ HyperLogLog_set_register(HyperLogLog *self, PyObject * args)
         return NULL;
     }
 
+    if (own_registers(self) < 0)
+        return NULL;
+
     self->registers[index] = rank;
 
     Py_INCREF(Py_None);
@@ -402,11 +2180,22 @@ HyperLogLog_set_register(HyperLogLog *self, PyObject * args)
 
 }
 
+/* Gets the name of the hash function. */
+static PyObject *
+HyperLogLog_hash(HyperLogLog *self)
+{
+    #if PY_MAJOR_VERSION >= 3
+    return PyUnicode_FromString(hllHashName(self->hash));
+    #else
+    return PyString_FromString(hllHashName(self->hash));
+    #endif
+}
+
 /* Gets the seed value used in the Murmur hash. */
 static PyObject *
 HyperLogLog_seed(HyperLogLog* self)
 {
-    return Py_BuildValue("i", self->seed);
+    return Py_BuildValue("I", self->seed);
 }
 
 /* Sets all the registers. */
@@ -421,10 +2210,15 @@ HyperLogLog_set_registers(HyperLogLog *self, PyObject *args)
     char* registers;
     registers = PyByteArray_AsString((PyObject*) regs);
 
+    if (own_registers(self) < 0)
+        return NULL;
+
+    begin_write(self);
     int i;
     for (i = 0; i < self->size; i++) {
             self->registers[i] = registers[i];
     }
+    end_write(self);
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -436,22 +2230,40 @@ HyperLogLog_set_state(HyperLogLog * self, PyObject * state)
 {
 
     char *registers;
-    if (!PyArg_ParseTuple(state, "s:setstate", &registers))
+    Py_ssize_t length;
+    if (!PyArg_ParseTuple(state, "s#:setstate", &registers, &length))
         return NULL;
 
-    int i;
-    for (i = 0; i < self->size; i++) {
-        if (registers[i] == 'z') {
-            self->registers[i] = 0;
-        } else {
-            self->registers[i] = registers[i];
-        }
+    if (length > 0 && registers[0] == HLL_EXPLICIT_BYTE) {
+        if (merge_explicit_bytes(self, registers, length) < 0)
+            return NULL;
+        Py_INCREF(Py_None);
+        return Py_None;
     }
 
+    if (length < self->size) {
+        PyErr_SetString(PyExc_ValueError, "Too few registers.");
+        return NULL;
+    }
+
+    if (own_registers(self) < 0)
+        return NULL;
+
+    begin_write(self);
+    hllDecode(self->registers, registers, self->size);
+    end_write(self);
+
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+/* Gets whether registers are updated atomically. */
+static PyObject *
+HyperLogLog_threadsafe(HyperLogLog* self)
+{
+    return PyBool_FromLong(self->threadsafe);
+}
+
 /* Gets the number of registers. */
 static PyObject *
 HyperLogLog_size(HyperLogLog* self)
@@ -459,27 +2271,173 @@ HyperLogLog_size(HyperLogLog* self)
     return Py_BuildValue("i", self->size);
 }
 
+/* Implements a | b, a new HyperLogLog with the union of a and b. The union
+ * has the size of the smaller HyperLogLog. */
+static PyObject *
+HyperLogLog_or(PyObject *a, PyObject *b)
+{
+    HyperLogLog *x, *y, *result;
+
+    if (!PyObject_TypeCheck(a, &HyperLogLogType) ||
+        !PyObject_TypeCheck(b, &HyperLogLogType)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    /* x is the smaller HyperLogLog. */
+    x = (HyperLogLog *) a;
+    y = (HyperLogLog *) b;
+    if (y->k < x->k) {
+        x = (HyperLogLog *) b;
+        y = (HyperLogLog *) a;
+    }
+
+    if (check_mergeable(x, (PyObject *) y, 1) < 0)
+        return NULL;
+
+    result = (HyperLogLog *) PyObject_CallFunction((PyObject *) Py_TYPE(a),
+                                                   "iI", x->k, x->seed);
+    if (result == NULL)
+        return NULL;
+    result->hash = x->hash;
+
+    if (merge_into(result, x) < 0 || merge_into(result, y) < 0) {
+        Py_DECREF(result);
+        return NULL;
+    }
+
+    return (PyObject *) result;
+}
+
+/* Implements a |= b, merging b into a. */
+static PyObject *
+HyperLogLog_inplace_or(PyObject *a, PyObject *b)
+{
+    HyperLogLog *self = (HyperLogLog *) a, *hll = (HyperLogLog *) b;
+
+    if (!PyObject_TypeCheck(b, &HyperLogLogType)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    if (check_mergeable(self, b, 1) < 0)
+        return NULL;
+
+    if (merge_into(self, hll) < 0)
+        return NULL;
+
+    Py_INCREF(a);
+    return a;
+}
+
+/* Designated initializers keep this valid for both python 2.x and 3.x,
+ * whose number protocols have different fields. */
+static PyNumberMethods HyperLogLog_as_number = {
+    .nb_or = HyperLogLog_or,
+    .nb_inplace_or = HyperLogLog_inplace_or,
+};
+
 static PyMethodDef HyperLogLog_methods[] = {
-    {"add", (PyCFunction)HyperLogLog_add, METH_VARARGS,
+    {"add", (PyCFunction)HyperLogLog_add, METH_O,
      "Add an element."
     },
-    {"cardinality", (PyCFunction)HyperLogLog_cardinality, METH_NOARGS,
+    {"add_hashes", (PyCFunction)HyperLogLog_add_hashes, METH_O,
+     "Add hashes from a buffer returned by hash_many()."
+    },
+    {"add_many", (PyCFunction)HyperLogLog_add_many,
+     METH_VARARGS | METH_KEYWORDS,
+     "Add every element of an iterable."
+    },
+    {"add_tuple", (PyCFunction)HyperLogLog_add_tuple, METH_O,
+     "Add a tuple of str, bytes and int fields."
+    },
+    {"add_tuples", (PyCFunction)HyperLogLog_add_tuples,
+     METH_VARARGS | METH_KEYWORDS,
+     "Add every tuple of an iterable."
+    },
+    {"__copy__", (PyCFunction)HyperLogLog_copy, METH_NOARGS,
+     "Get a copy of the HyperLogLog."
+    },
+    {"__deepcopy__", (PyCFunction)HyperLogLog_deepcopy, METH_O,
+     "Get a copy of the HyperLogLog."
+    },
+    {"cardinality", (PyCFunction)HyperLogLog_cardinality,
+     METH_VARARGS | METH_KEYWORDS,
      "Get the cardinality."
     },
-    {"merge", (PyCFunction)HyperLogLog_merge, METH_VARARGS,
+    {"cardinality_with_error", (PyCFunction)HyperLogLog_cardinality_with_error,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get the cardinality, its standard error and a confidence interval."
+    },
+    {"copy", (PyCFunction)HyperLogLog_copy, METH_NOARGS,
+     "Get a copy of the HyperLogLog."
+    },
+    {"estimate", (PyCFunction)HyperLogLog_estimate,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get the cardinality from a register histogram."
+    },
+    {"from_buffer", (PyCFunction)HyperLogLog_from_buffer,
+     METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Create a HyperLogLog with its registers in a writable buffer."
+    },
+    {"hash", (PyCFunction)HyperLogLog_hash, METH_NOARGS,
+     "Get the name of the hash function."
+    },
+    {"hash_many", (PyCFunction)HyperLogLog_hash_many,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get a buffer of the hashes of every element of an iterable or buffer."
+    },
+    {"intersection_cardinality",
+     (PyCFunction)HyperLogLog_intersection_cardinality,
+     METH_VARARGS | METH_CLASS,
+     "Get the cardinality of the intersection of two HyperLogLogs."
+    },
+    {"jaccard", (PyCFunction)HyperLogLog_jaccard, METH_VARARGS | METH_CLASS,
+     "Get the Jaccard index of two HyperLogLogs."
+    },
+    {"merge", (PyCFunction)HyperLogLog_merge, METH_O,
      "Merge another HyperLogLog object with the current HyperLogLog."
     },
-    {"murmur3_hash", (PyCFunction)HyperLogLog_murmur3_hash, METH_VARARGS,
+    {"merge_bytes", (PyCFunction)HyperLogLog_merge_bytes, METH_O,
+     "Merge serialized registers with the current HyperLogLog."
+    },
+    {"merge_bytes_many", (PyCFunction)HyperLogLog_merge_bytes_many, METH_O,
+     "Merge an iterable of serialized registers with the current HyperLogLog."
+    },
+    {"murmur3_hash", (PyCFunction)HyperLogLog_murmur3_hash, METH_O,
      "Gets a Murmur3 hash"
     },
+    {"threadsafe", (PyCFunction)HyperLogLog_threadsafe, METH_NOARGS,
+     "Returns whether registers are updated atomically."
+    },
+    {"union", (PyCFunction)HyperLogLog_union,
+     METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Create a HyperLogLog from the union of HyperLogLogs."
+    },
+    {"union_cardinality", (PyCFunction)HyperLogLog_union_cardinality,
+     METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Get the cardinality of the union of HyperLogLogs."
+    },
+    {"union_into", (PyCFunction)HyperLogLog_union_into,
+     METH_VARARGS | METH_KEYWORDS,
+     "Merge HyperLogLogs into the current HyperLogLog."
+    },
     {"__reduce__", (PyCFunction)HyperLogLog_reduce, METH_NOARGS, 
      "Serialization function for pickling."
     }, 
+    {"register_histogram", (PyCFunction)HyperLogLog_register_histogram,
+     METH_NOARGS,
+     "Get the number of registers with each rank."
+    },
+    {"reduce_precision", (PyCFunction)HyperLogLog_reduce_precision,
+     METH_VARARGS,
+     "Reduce the number of registers to 2^k."
+    },
     {"registers", (PyCFunction)HyperLogLog_registers, METH_NOARGS, 
      "Get a copy of the registers as a bytearray."
     },
     {"seed", (PyCFunction)HyperLogLog_seed, METH_NOARGS, 
-     "Get the seed used in the Murmur3 hash."
+     "Get the seed used in the hash."
     },
     {"set_registers", (PyCFunction)HyperLogLog_set_registers, METH_VARARGS,
      "Set the registers with a bytearray."
@@ -490,13 +2448,16 @@ static PyMethodDef HyperLogLog_methods[] = {
     {"__setstate__", (PyCFunction)HyperLogLog_set_state, METH_VARARGS, 
     "De-serialization function for pickling."
     },
+    {"snapshot", (PyCFunction)HyperLogLog_snapshot, METH_NOARGS,
+     "Get a copy of the HyperLogLog that shares registers until modified."
+    },
     {"size", (PyCFunction)HyperLogLog_size, METH_NOARGS, 
      "Returns the number of registers."
     },
     {NULL}  /* Sentinel */
 };
 
-static PyTypeObject HyperLogLogType = {
+PyTypeObject HyperLogLogType = {
     #if PY_MAJOR_VERSION >= 3
     PyVarObject_HEAD_INIT(NULL, 0)
     #else
@@ -512,7 +2473,7 @@ static PyTypeObject HyperLogLogType = {
     0,                         /*tp_setattr*/ 
     0,                         /*tp_compare*/
     0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
+    &HyperLogLog_as_number,    /*tp_as_number*/
     0,                         /*tp_as_sequence*/
     0,                         /*tp_as_mapping*/
     0,                         /*tp_hash */
@@ -522,7 +2483,8 @@ static PyTypeObject HyperLogLogType = {
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
     Py_TPFLAGS_DEFAULT | 
-        Py_TPFLAGS_BASETYPE,   /*tp_flags*/
+        Py_TPFLAGS_BASETYPE |
+        HLL_TPFLAGS_CHECKTYPES, /*tp_flags*/
     "HyperLogLog object",      /* tp_doc */
     0,		                   /* tp_traverse */
     0,		                   /* tp_clear */
@@ -569,7 +2531,13 @@ PyMODINIT_FUNC initHLL(void)
 #endif
 {
     PyObject* m;
-    if (PyType_Ready(&HyperLogLogType) < 0) {
+    if (PyType_Ready(&HyperLogLogType) < 0 ||
+        PyType_Ready(&ShardedHyperLogLogType) < 0 ||
+        PyType_Ready(&GroupedHyperLogLogType) < 0 ||
+        PyType_Ready(&HyperLogLogArrayType) < 0 ||
+        PyType_Ready(&AsyncIngestorType) < 0 ||
+        PyType_Ready(&HashBufferType) < 0 ||
+        PyType_Ready(&EstimateBufferType) < 0) {
 
     #if PY_MAJOR_VERSION >= 3
         return NULL;
@@ -591,9 +2559,28 @@ PyMODINIT_FUNC initHLL(void)
         return;
         #endif
 
+    #ifdef Py_GIL_DISABLED
+    PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED);
+    #endif
+
     Py_INCREF(&HyperLogLogType);
     PyModule_AddObject(m, "HyperLogLog", (PyObject *)&HyperLogLogType);
 
+    Py_INCREF(&ShardedHyperLogLogType);
+    PyModule_AddObject(m, "ShardedHyperLogLog",
+                       (PyObject *)&ShardedHyperLogLogType);
+
+    Py_INCREF(&GroupedHyperLogLogType);
+    PyModule_AddObject(m, "GroupedHyperLogLog",
+                       (PyObject *)&GroupedHyperLogLogType);
+
+    Py_INCREF(&HyperLogLogArrayType);
+    PyModule_AddObject(m, "HyperLogLogArray",
+                       (PyObject *)&HyperLogLogArrayType);
+
+    Py_INCREF(&AsyncIngestorType);
+    PyModule_AddObject(m, "AsyncIngestor", (PyObject *)&AsyncIngestorType);
+
     #if PY_MAJOR_VERSION >= 3
     return m;
     #endif
@@ -1,3 +1,132 @@
+#ifndef _HLL_H_
+#define _HLL_H_
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+#include "explicit.h"
+
+/* Merges of at least this many registers, and batches of at least this many
+ * elements, release the GIL. */
+#define HLL_NOGIL_SIZE (1 << 14)
+
+/* Without the GIL threads update registers concurrently, so HyperLogLogs
+ * are thread safe by default. */
+#ifdef Py_GIL_DISABLED
+#define HLL_THREADSAFE_DEFAULT 1
+#else
+#define HLL_THREADSAFE_DEFAULT 0
+#endif
+
+/* Critical sections only exist, and are only needed, on python 3.13+. */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+#ifndef Py_BEGIN_CRITICAL_SECTION2
+#define Py_BEGIN_CRITICAL_SECTION2(a, b) {
+#define Py_END_CRITICAL_SECTION2() }
+#endif
+
+typedef struct {
+    PyObject_HEAD
+    short int k;      /* size = 2^k */
+    uint32_t seed;    /* hash seed */
+    uint32_t size;    /* number of registers */
+    int threadsafe;   /* update registers atomically */
+    int hash;         /* hash function, see hash.h */
+    char *registers __attribute__ ((aligned (8))); /* ranks, NULL if explicit */
+    ExplicitSet small; /* distinct hashes while there are no registers */
+    Py_buffer shared; /* buffer holding the registers, see from_buffer() */
+    uint64_t writesBegun; /* bulk register writes begun */
+    uint64_t writesEnded; /* bulk register writes ended */
+    uint32_t *shares; /* HyperLogLogs sharing the registers, see snapshot() */
+    int ingestors;    /* AsyncIngestors writing the registers */
+    int pins;         /* merges reading the registers, see pin_registers() */
+} HyperLogLog;
+
+/* A contiguous array of 4 or 8 byte hashes, see hash_many(). */
+typedef struct {
+    PyObject_HEAD
+    void *hashes;
+    Py_ssize_t count;
+    Py_ssize_t width; /* bytes per hash */
+} HashBuffer;
+
+/* A contiguous array of cardinality estimates, see
+ * HyperLogLogArray.cardinalities(). */
+typedef struct {
+    PyObject_HEAD
+    double *estimates;
+    Py_ssize_t count;
+} EstimateBuffer;
+
+extern PyTypeObject HyperLogLogType;
+
+extern PyTypeObject ShardedHyperLogLogType;
+
+extern PyTypeObject GroupedHyperLogLogType;
+
+extern PyTypeObject HyperLogLogArrayType;
+
+extern PyTypeObject AsyncIngestorType;
+
+extern PyTypeObject HashBufferType;
+
+extern PyTypeObject EstimateBufferType;
+
+HashBuffer *hllHashBufferNew(Py_ssize_t count, int width);
+
+EstimateBuffer *hllEstimateBufferNew(Py_ssize_t count);
+
+int hllOwnRegisters(HyperLogLog *self);
+
 uint32_t leadingZeroCount(uint32_t x);
 
 uint32_t ones(uint32_t x);
+
+/* Gets the bytes of an element: a str as UTF-8, or the bytes of a bytes or
+ * buffer object, like the "s#" format. Compact ASCII str, whose characters
+ * are already their UTF-8 encoding, and bytes are read in place without
+ * going through the format parser. Returns 0 with an exception set on
+ * failure, like PyArg_Parse(). */
+static inline int
+hllKeyData(PyObject *key, const char **data, Py_ssize_t *length)
+{
+    #if PY_MAJOR_VERSION >= 3
+    if (PyUnicode_Check(key) && PyUnicode_IS_COMPACT_ASCII(key)) {
+        *data = (const char *) PyUnicode_DATA(key);
+        *length = PyUnicode_GET_LENGTH(key);
+        return 1;
+    }
+    if (PyBytes_Check(key)) {
+        *data = PyBytes_AS_STRING(key);
+        *length = PyBytes_GET_SIZE(key);
+        return 1;
+    }
+    #else
+    if (PyString_Check(key)) {
+        *data = PyString_AS_STRING(key);
+        *length = PyString_GET_SIZE(key);
+        return 1;
+    }
+    #endif
+
+    return PyArg_Parse(key, "s#", data, length);
+}
+
+/* Use the first k bits of a hash as a zero based register index. */
+static inline uint32_t
+hllIndex(uint32_t hash, short int k)
+{
+    return hash >> (32 - k);
+}
+
+/* Compute the rank, lzc + 1, of the remaining 32 - k bits of a hash. */
+static inline uint32_t
+hllRank(uint32_t hash, short int k)
+{
+    return leadingZeroCount((hash << k) >> k) - k + 1;
+}
+
+#endif // _HLL_H_
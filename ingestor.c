@@ -0,0 +1,582 @@
+#include "hash.h"
+#include "hll.h"
+#include "registers.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Keys up to this many bytes are copied into the queue slot itself, longer
+ * keys are copied to the heap. */
+#define HLL_SLOT_INLINE 40
+
+/* The drain thread checks for waiting flush() calls after this many keys, and
+ * producers only wake it once this many keys, or half the queue, are
+ * waiting. */
+#define HLL_DRAIN_BATCH 256
+
+/* A sleeping drain thread wakes up on its own after this long, so keys are
+ * added soon after submit() even when few arrive. After a wait in which no
+ * key arrives it goes idle and sleeps until a producer wakes it. */
+#define HLL_DRAIN_WAIT_NS 1000000
+
+/* States of the drain thread, see AsyncIngestor.sleeping. */
+#define HLL_DRAIN_AWAKE 0
+#define HLL_DRAIN_WAITING 1   /* wakes on its own or for a batch of keys */
+#define HLL_DRAIN_IDLE 2      /* only wakes for the next key */
+
+/* A queue slot, one cache line. The sequence numbers the slot's turn: it
+ * equals the queue position when the slot is free and the position + 1 once
+ * it holds a key. */
+typedef struct {
+    uint64_t sequence;
+    uint32_t length;
+    char *data;
+    char key[HLL_SLOT_INLINE];
+} Slot;
+
+/* Adds keys to a HyperLogLog on a native thread. Producers claim slots of a
+ * bounded ring buffer with a compare-and-swap on the enqueue position, the
+ * drain thread hashes the keys in order and updates the registers atomically.
+ */
+typedef struct {
+    PyObject_HEAD
+    HyperLogLog *hll;
+    Slot *slots;
+    uint64_t mask;          /* capacity - 1 */
+    uint64_t batch;         /* waiting keys that wake the drain thread */
+    uint64_t enqueued;      /* next position to claim */
+    uint64_t processed;     /* positions drained */
+    int sleeping;           /* HLL_DRAIN_ state of the drain thread */
+    int flushing;           /* number of threads waiting in flush() */
+    int stop;               /* the drain thread exits once the queue is empty */
+    int started;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /* signaled when keys arrive */
+    pthread_cond_t drained; /* signaled when processed advances */
+} AsyncIngestor;
+
+/* Hashes a key and updates the register with its rank. */
+static inline void
+ingest(HyperLogLog *hll, const char *data, uint32_t length)
+{
+    uint32_t hash = hllHash(hll->hash, data, length, hll->seed);
+
+    hllAtomicMax(&hll->registers[hllIndex(hash, hll->k)],
+                 hllRank(hash, hll->k));
+}
+
+/* Wakes threads waiting in flush(). */
+static void
+notify_drained(AsyncIngestor *self)
+{
+    if (__atomic_load_n(&self->flushing, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&self->lock);
+        pthread_cond_broadcast(&self->drained);
+        pthread_mutex_unlock(&self->lock);
+    }
+}
+
+static void *
+drain(void *arg)
+{
+    AsyncIngestor *self = (AsyncIngestor *) arg;
+    uint64_t position = 0;
+    struct timespec deadline;
+    int count = 0, idle = 0;
+
+    for (;;) {
+        Slot *slot = &self->slots[position & self->mask];
+
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) ==
+            position + 1) {
+            ingest(self->hll, slot->data, slot->length);
+            if (slot->data != slot->key)
+                free(slot->data);
+
+            __atomic_store_n(&slot->sequence, position + self->mask + 1,
+                             __ATOMIC_RELEASE);
+            __atomic_store_n(&self->processed, ++position, __ATOMIC_RELEASE);
+
+            idle = 0;
+            if (++count == HLL_DRAIN_BATCH) {
+                notify_drained(self);
+                count = 0;
+            }
+            continue;
+        }
+
+        /* The queue is empty. Producers check sleeping after publishing a
+         * key, and the queue is checked again after setting it, so neither
+         * a full batch nor the first key for an idle thread waits for a
+         * wake up that doesn't come. */
+        pthread_mutex_lock(&self->lock);
+        __atomic_store_n(&self->sleeping,
+                         idle ? HLL_DRAIN_IDLE : HLL_DRAIN_WAITING,
+                         __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&self->drained);
+        count = 0;
+
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) !=
+            position + 1) {
+            if (__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE) &&
+                __atomic_load_n(&self->enqueued, __ATOMIC_ACQUIRE) ==
+                position) {
+                pthread_mutex_unlock(&self->lock);
+                break;
+            }
+            if (idle) {
+                pthread_cond_wait(&self->wake, &self->lock);
+            } else {
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += HLL_DRAIN_WAIT_NS;
+                if (deadline.tv_nsec >= 1000000000) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                idle = pthread_cond_timedwait(&self->wake, &self->lock,
+                                              &deadline) == ETIMEDOUT;
+            }
+        }
+
+        __atomic_store_n(&self->sleeping, HLL_DRAIN_AWAKE, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&self->lock);
+    }
+
+    return NULL;
+}
+
+/* Wakes the drain thread if it sleeps and at least waiting keys are
+ * queued, or any key once it is idle. */
+static void
+wake_drain(AsyncIngestor *self, uint64_t waiting)
+{
+    int sleeping;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    sleeping = __atomic_load_n(&self->sleeping, __ATOMIC_SEQ_CST);
+    if (sleeping == HLL_DRAIN_IDLE)
+        waiting = 0;
+    if (sleeping != HLL_DRAIN_AWAKE &&
+        __atomic_load_n(&self->enqueued, __ATOMIC_RELAXED) -
+        __atomic_load_n(&self->processed, __ATOMIC_RELAXED) >= waiting) {
+        pthread_mutex_lock(&self->lock);
+        pthread_cond_signal(&self->wake);
+        pthread_mutex_unlock(&self->lock);
+    }
+}
+
+/* Claims a slot, waiting without the GIL while the queue is full. */
+static Slot *
+claim_slot(AsyncIngestor *self)
+{
+    PyThreadState *state = NULL;
+    uint64_t position;
+    Slot *slot;
+
+    position = __atomic_load_n(&self->enqueued, __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t sequence;
+
+        slot = &self->slots[position & self->mask];
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+        if (sequence == position) {
+            if (__atomic_compare_exchange_n(&self->enqueued, &position,
+                                            position + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (sequence < position) {
+            /* Full, the slot still holds a key from the previous lap. */
+            if (state == NULL)
+                state = PyEval_SaveThread();
+            wake_drain(self, 0);
+            sched_yield();
+            position = __atomic_load_n(&self->enqueued, __ATOMIC_RELAXED);
+        } else {
+            position = __atomic_load_n(&self->enqueued, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+
+    return slot;
+}
+
+/* Copies a key into the queue. Returns -1 with an exception set on
+ * failure. */
+static int
+submit_key(AsyncIngestor *self, const char *data, Py_ssize_t dataLength)
+{
+    Slot *slot;
+    char *copy;
+    uint64_t position;
+
+    if (dataLength <= HLL_SLOT_INLINE) {
+        copy = NULL;
+    } else if ((copy = (char *) malloc(dataLength)) == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    } else {
+        memcpy(copy, data, dataLength);
+    }
+
+    slot = claim_slot(self);
+    position = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+    if (copy == NULL) {
+        memcpy(slot->key, data, dataLength);
+        slot->data = slot->key;
+    } else {
+        slot->data = copy;
+    }
+    slot->length = (uint32_t) dataLength;
+
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    wake_drain(self, self->batch);
+    return 0;
+}
+
+static int
+check_open(AsyncIngestor *self)
+{
+    if (self->slots == NULL || self->stop) {
+        PyErr_SetString(PyExc_ValueError, "AsyncIngestor is closed.");
+        return -1;
+    }
+    return 0;
+}
+
+/* Waits until every key submitted before the call has been added. */
+static void
+flush(AsyncIngestor *self)
+{
+    uint64_t target = __atomic_load_n(&self->enqueued, __ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&self->processed, __ATOMIC_ACQUIRE) >= target)
+        return;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    __atomic_fetch_add(&self->flushing, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&self->processed, __ATOMIC_ACQUIRE) < target) {
+        pthread_cond_signal(&self->wake);
+        pthread_cond_wait(&self->drained, &self->lock);
+    }
+    __atomic_fetch_sub(&self->flushing, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+}
+
+/* Drains the queue and stops the drain thread. */
+static void
+stop_drain(AsyncIngestor *self)
+{
+    if (!self->started)
+        return;
+
+    pthread_mutex_lock(&self->lock);
+    __atomic_store_n(&self->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(self->thread, NULL);
+    Py_END_ALLOW_THREADS
+    self->started = 0;
+    __atomic_fetch_sub(&self->hll->ingestors, 1, __ATOMIC_RELEASE);
+}
+
+static void
+AsyncIngestor_dealloc(AsyncIngestor *self)
+{
+    stop_drain(self);
+    if (self->slots != NULL) {
+        pthread_mutex_destroy(&self->lock);
+        pthread_cond_destroy(&self->wake);
+        pthread_cond_destroy(&self->drained);
+    }
+    free(self->slots);
+    Py_XDECREF(self->hll);
+    #if PY_MAJOR_VERSION >= 3
+    Py_TYPE(self)->tp_free((PyObject*) self);
+    #else
+    self->ob_type->tp_free((PyObject*) self);
+    #endif
+}
+
+/* Readies the registers of hll for a drain thread. The drain thread writes
+ * them, so they can't be shared with snapshots, every other write to them
+ * must be atomic too, and they are counted as fed so they are never resized.
+ * Done in a critical section, as another thread may be unsharing or
+ * resizing them. Returns -1 with an exception set on failure. */
+static int
+attach(HyperLogLog *hll)
+{
+    int status;
+
+    Py_BEGIN_CRITICAL_SECTION(hll);
+    status = hllOwnRegisters(hll);
+    if (status == 0) {
+        hll->threadsafe = 1;
+        __atomic_fetch_add(&hll->ingestors, 1, __ATOMIC_RELEASE);
+    }
+    Py_END_CRITICAL_SECTION();
+
+    return status;
+}
+
+static PyObject *
+AsyncIngestor_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    return type->tp_alloc(type, 0);
+}
+
+static int
+AsyncIngestor_init(AsyncIngestor *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"hll", "capacity", NULL};
+    PyObject *hll;
+    Py_ssize_t capacity = 65536;
+    uint64_t size, i;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|n", kwlist,
+                                     &HyperLogLogType, &hll, &capacity))
+        return -1;
+
+    if (capacity < 1 || capacity > (1 << 30)) {
+        char * msg = "Capacity must be in the range [1, 2^30]";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    if (self->slots != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Already initialized.");
+        return -1;
+    }
+
+    for (size = 2; size < (uint64_t) capacity; size <<= 1);
+
+    self->slots = (Slot *) malloc(size * sizeof(Slot));
+    if (self->slots == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < size; i++)
+        self->slots[i].sequence = i;
+    self->mask = size - 1;
+    self->batch = size / 2 < HLL_DRAIN_BATCH ? size / 2 : HLL_DRAIN_BATCH;
+
+    Py_INCREF(hll);
+    self->hll = (HyperLogLog *) hll;
+
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->wake, NULL);
+    pthread_cond_init(&self->drained, NULL);
+
+    if (attach(self->hll) < 0) {
+        self->stop = 1;
+        return -1;
+    }
+
+    if (pthread_create(&self->thread, NULL, drain, self) != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Can't start the drain thread.");
+        __atomic_fetch_sub(&self->hll->ingestors, 1, __ATOMIC_RELEASE);
+        self->stop = 1;
+        return -1;
+    }
+    self->started = 1;
+
+    return 0;
+}
+
+/* Copies a key into the queue to be added by the drain thread. */
+static PyObject *
+AsyncIngestor_submit(AsyncIngestor *self, PyObject *key)
+{
+    const char *data;
+    Py_ssize_t dataLength;
+
+    if (!hllKeyData(key, &data, &dataLength))
+        return NULL;
+
+    if (check_open(self) < 0 || submit_key(self, data, dataLength) < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Copies every key of an iterable into the queue. */
+static PyObject *
+AsyncIngestor_submit_many(AsyncIngestor *self, PyObject *iterable)
+{
+    PyObject *iterator, *item;
+
+    if (check_open(self) < 0)
+        return NULL;
+
+    if ((iterator = PyObject_GetIter(iterable)) == NULL)
+        return NULL;
+
+    while ((item = PyIter_Next(iterator)) != NULL) {
+        const char *data;
+        Py_ssize_t dataLength;
+
+        if (!hllKeyData(item, &data, &dataLength) ||
+            submit_key(self, data, dataLength) < 0) {
+            Py_DECREF(item);
+            Py_DECREF(iterator);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    Py_DECREF(iterator);
+
+    if (PyErr_Occurred())
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Waits until every key submitted so far has been added. */
+static PyObject *
+AsyncIngestor_flush(AsyncIngestor *self)
+{
+    if (check_open(self) < 0)
+        return NULL;
+
+    flush(self);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Adds every key submitted so far and stops the drain thread. */
+static PyObject *
+AsyncIngestor_close(AsyncIngestor *self)
+{
+    stop_drain(self);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Gets a cardinality estimate of the HyperLogLog after adding every key
+ * submitted so far. */
+static PyObject *
+AsyncIngestor_cardinality(AsyncIngestor *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *method, *result;
+
+    if (check_open(self) < 0)
+        return NULL;
+
+    flush(self);
+
+    method = PyObject_GetAttrString((PyObject *) self->hll, "cardinality");
+    if (method == NULL)
+        return NULL;
+
+    result = PyObject_Call(method, args, kwds);
+    Py_DECREF(method);
+    return result;
+}
+
+/* Gets the HyperLogLog keys are added to. */
+static PyObject *
+AsyncIngestor_hll(AsyncIngestor *self)
+{
+    if (self->hll == NULL) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    Py_INCREF(self->hll);
+    return (PyObject *) self->hll;
+}
+
+/* Gets the number of keys the queue can hold. */
+static PyObject *
+AsyncIngestor_capacity(AsyncIngestor *self)
+{
+    return Py_BuildValue("K", (unsigned long long) (self->mask + 1));
+}
+
+static PyMethodDef AsyncIngestor_methods[] = {
+    {"capacity", (PyCFunction)AsyncIngestor_capacity, METH_NOARGS,
+     "Returns the number of keys the queue can hold."
+    },
+    {"cardinality", (PyCFunction)AsyncIngestor_cardinality,
+     METH_VARARGS | METH_KEYWORDS,
+     "Flush and get the cardinality of the HyperLogLog."
+    },
+    {"close", (PyCFunction)AsyncIngestor_close, METH_NOARGS,
+     "Add every submitted key and stop the drain thread."
+    },
+    {"flush", (PyCFunction)AsyncIngestor_flush, METH_NOARGS,
+     "Wait until every submitted key has been added."
+    },
+    {"hll", (PyCFunction)AsyncIngestor_hll, METH_NOARGS,
+     "Returns the HyperLogLog keys are added to."
+    },
+    {"submit", (PyCFunction)AsyncIngestor_submit, METH_O,
+     "Queue a key to be added."
+    },
+    {"submit_many", (PyCFunction)AsyncIngestor_submit_many, METH_O,
+     "Queue every key of an iterable to be added."
+    },
+    {NULL}  /* Sentinel */
+};
+
+PyTypeObject AsyncIngestorType = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    #endif
+    "HLL.AsyncIngestor",       /*tp_name*/
+    sizeof(AsyncIngestor),     /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)AsyncIngestor_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Adds keys to a HyperLogLog on a background thread", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    AsyncIngestor_methods,     /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)AsyncIngestor_init, /* tp_init */
+    0,                         /* tp_alloc */
+    AsyncIngestor_new,         /* tp_new */
+};
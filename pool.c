@@ -0,0 +1,159 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+/* The tasks of one hllRunTasks() call. It lives on the caller's stack and is
+ * queued until every task has been taken. */
+typedef struct PoolJob {
+    void *(*fn)(void *);
+    char *tasks;
+    size_t size;
+    int count;
+    int next;              /* next task to take */
+    int pending;           /* tasks not finished yet */
+    struct PoolJob *link;  /* next job in the queue */
+} PoolJob;
+
+/* Pool threads are started the first time they are needed and then wait for
+ * jobs for the life of the process, so a batch doesn't pay for creating and
+ * joining threads. Everything below is guarded by poolLock. */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;  /* job queued */
+static pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;  /* job finished */
+static PoolJob *poolQueue = NULL;
+static int poolThreads = 0;
+static int poolForkHandlers = 0;
+
+/* Takes the next task of job, dequeuing the job once its last task is
+ * taken. */
+static int
+take_task(PoolJob *job)
+{
+    PoolJob **link;
+    int id = job->next++;
+
+    if (job->next == job->count) {
+        for (link = &poolQueue; *link != job; link = &(*link)->link)
+            ;
+        *link = job->link;
+    }
+
+    return id;
+}
+
+/* Runs task id of job with poolLock released. The job may be gone once this
+ * returns. */
+static void
+run_task(PoolJob *job, int id)
+{
+    pthread_mutex_unlock(&poolLock);
+    job->fn(job->tasks + (size_t) id * job->size);
+    pthread_mutex_lock(&poolLock);
+
+    if (--job->pending == 0)
+        pthread_cond_broadcast(&poolDone);
+}
+
+static void *
+pool_thread(void *arg)
+{
+    PoolJob *job;
+
+    pthread_mutex_lock(&poolLock);
+    for (;;) {
+        while (poolQueue == NULL)
+            pthread_cond_wait(&poolWork, &poolLock);
+        job = poolQueue;
+        run_task(job, take_task(job));
+    }
+
+    return NULL;
+}
+
+/* The lock is held across fork() so the queue is consistent. A forked child
+ * has none of the pool threads, and its condition variables may still count
+ * them as waiters, so they are created anew. */
+static void
+lock_pool(void)
+{
+    pthread_mutex_lock(&poolLock);
+}
+
+static void
+unlock_pool(void)
+{
+    pthread_mutex_unlock(&poolLock);
+}
+
+static void
+reset_pool(void)
+{
+    poolQueue = NULL;
+    poolThreads = 0;
+    pthread_cond_init(&poolWork, NULL);
+    pthread_cond_init(&poolDone, NULL);
+    pthread_mutex_unlock(&poolLock);
+}
+
+/* Starts pool threads until the pool has threads of them. Threads that fail
+ * to start leave their tasks to the callers. */
+static void
+grow_pool(int threads)
+{
+    pthread_attr_t attributes;
+    pthread_t thread;
+
+    if (threads > HLL_POOL_MAX_THREADS)
+        threads = HLL_POOL_MAX_THREADS;
+    if (poolThreads >= threads)
+        return;
+
+    if (!poolForkHandlers) {
+        if (pthread_atfork(lock_pool, unlock_pool, reset_pool) != 0)
+            return;
+        poolForkHandlers = 1;
+    }
+
+    if (pthread_attr_init(&attributes) != 0)
+        return;
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    while (poolThreads < threads &&
+           pthread_create(&thread, &attributes, pool_thread, NULL) == 0)
+        poolThreads++;
+    pthread_attr_destroy(&attributes);
+}
+
+void hllRunTasks(void *(*fn)(void *), void *tasks, size_t size, int count)
+{
+    PoolJob job, **link;
+
+    if (count <= 0)
+        return;
+    if (count == 1) {
+        fn(tasks);
+        return;
+    }
+
+    job.fn = fn;
+    job.tasks = (char *) tasks;
+    job.size = size;
+    job.count = count;
+    job.next = 0;
+    job.pending = count;
+    job.link = NULL;
+
+    pthread_mutex_lock(&poolLock);
+    grow_pool(count - 1);
+    for (link = &poolQueue; *link != NULL; link = &(*link)->link)
+        ;
+    *link = &job;
+    pthread_cond_broadcast(&poolWork);
+
+    /* The caller works through its own tasks too, so the job finishes even
+     * when every pool thread is busy with other jobs. */
+    while (job.next < job.count)
+        run_task(&job, take_task(&job));
+    while (job.pending > 0)
+        pthread_cond_wait(&poolDone, &poolLock);
+    pthread_mutex_unlock(&poolLock);
+}
@@ -0,0 +1,14 @@
+#ifndef _HLL_POOL_H_
+#define _HLL_POOL_H_
+
+#include <stddef.h>
+
+/* The pool never grows beyond this many threads. */
+#define HLL_POOL_MAX_THREADS 255
+
+/* Calls fn once for each of count tasks of size bytes at tasks, on the
+ * calling thread and on up to count - 1 threads of a shared pool. Returns
+ * once every task is done. Doesn't need the GIL. */
+void hllRunTasks(void *(*fn)(void *), void *tasks, size_t size, int count);
+
+#endif // _HLL_POOL_H_
@@ -0,0 +1,488 @@
+#include "pool.h"
+#include "registers.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define HLL_SSE2
+#include <emmintrin.h>
+#endif
+
+/* AVX2 kernels are compiled with a target attribute and selected at run time
+ * so the module still loads on CPUs without AVX2. */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HLL_AVX2
+#include <immintrin.h>
+#endif
+
+/* Sketches with fewer registers than this are counted without
+ * sub-histograms. */
+#define HLL_SMALL_HISTOGRAM 1024
+
+/* Adds the number of registers with each rank to four sub-histograms.
+ *
+ * Four sub-histograms are used so consecutive registers with the same rank
+ * don't serialize on a single counter. Blocks of 16 registers that all hold
+ * the same rank, which is the common case for lightly filled and saturated
+ * sketches, are detected with SSE2 and counted in one step.
+ */
+static void
+count_ranks(const uint8_t *regs, uint32_t size, uint32_t sub[4][256])
+{
+    uint32_t i = 0;
+    int j;
+
+    #ifdef HLL_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (regs + i));
+        __m128i first = _mm_set1_epi8((char) regs[i]);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, first)) == 0xFFFF) {
+            sub[0][regs[i]] += 16;
+            continue;
+        }
+
+        for (j = 0; j < 16; j += 4) {
+            sub[0][regs[i + j]]++;
+            sub[1][regs[i + j + 1]]++;
+            sub[2][regs[i + j + 2]]++;
+            sub[3][regs[i + j + 3]]++;
+        }
+    }
+    #endif
+
+    for (; i + 4 <= size; i += 4) {
+        sub[0][regs[i]]++;
+        sub[1][regs[i + 1]]++;
+        sub[2][regs[i + 2]]++;
+        sub[3][regs[i + 3]]++;
+    }
+    for (; i < size; i++) {
+        sub[0][regs[i]]++;
+    }
+}
+
+/* Sums the sub-histograms into HLL_HISTOGRAM_SIZE counts. */
+static void
+fold_ranks(uint32_t sub[4][256], uint32_t *counts)
+{
+    int j;
+
+    memset(counts, 0, HLL_HISTOGRAM_SIZE * sizeof(uint32_t));
+    for (j = 0; j < 256; j++) {
+        uint32_t n = sub[0][j] + sub[1][j] + sub[2][j] + sub[3][j];
+        counts[j < HLL_HISTOGRAM_SIZE ? j : HLL_HISTOGRAM_SIZE - 1] += n;
+    }
+}
+
+/* Counts the number of registers with each rank. counts must have room for
+ * HLL_HISTOGRAM_SIZE entries. */
+void hllHistogram(const char *registers, uint32_t size, uint32_t *counts)
+{
+    uint32_t sub[4][256];
+    uint32_t i;
+
+    /* Small sketches, such as the rows of a HyperLogLogArray, are counted
+     * directly rather than paying for clearing and folding sub. */
+    if (size < HLL_SMALL_HISTOGRAM) {
+        memset(counts, 0, HLL_HISTOGRAM_SIZE * sizeof(uint32_t));
+        for (i = 0; i < size; i++) {
+            uint8_t r = (uint8_t) registers[i];
+            counts[r < HLL_HISTOGRAM_SIZE ? r : HLL_HISTOGRAM_SIZE - 1]++;
+        }
+        return;
+    }
+
+    memset(sub, 0, sizeof(sub));
+    count_ranks((const uint8_t *) registers, size, sub);
+    fold_ranks(sub, counts);
+}
+
+/* Counts the register pairs of two sketches by how they compare, in one
+ * pass over both. Pairs are counted without branches in a table indexed by
+ * both ranks, which is then split into the joint histograms. Runs of equal
+ * 16 register blocks are detected with SSE2 and counted with count_ranks().
+ */
+void hllJointHistogram(const char *registers, const char *other,
+                       uint32_t size, JointHistogram *joint)
+{
+    const uint8_t *r1 = (const uint8_t *) registers;
+    const uint8_t *r2 = (const uint8_t *) other;
+    uint32_t sub[4][256];
+    uint32_t equal[HLL_HISTOGRAM_SIZE];
+    uint32_t pairs[HLL_HISTOGRAM_SIZE * HLL_HISTOGRAM_SIZE];
+    uint32_t i = 0, end, n;
+    int a, b;
+
+    memset(pairs, 0, sizeof(pairs));
+    memset(sub, 0, sizeof(sub));
+    memset(joint, 0, sizeof(JointHistogram));
+
+    while (i < size) {
+        end = size;
+
+        #ifdef HLL_SSE2
+        /* Count the run of equal 16 register blocks at i. */
+        for (end = i; end + 16 <= size; end += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (r1 + end));
+            __m128i y = _mm_loadu_si128((const __m128i *) (r2 + end));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF)
+                break;
+        }
+        count_ranks(r1 + i, end - i, sub);
+        i = end;
+        end = i + 16 < size ? i + 16 : size;
+        #endif
+
+        for (; i < end; i++) {
+            a = r1[i] < HLL_HISTOGRAM_SIZE ? r1[i] : HLL_HISTOGRAM_SIZE - 1;
+            b = r2[i] < HLL_HISTOGRAM_SIZE ? r2[i] : HLL_HISTOGRAM_SIZE - 1;
+            pairs[a * HLL_HISTOGRAM_SIZE + b]++;
+        }
+    }
+
+    fold_ranks(sub, equal);
+    for (a = 0; a < HLL_HISTOGRAM_SIZE; a++) {
+        joint->equal[a] = equal[a] + pairs[a * HLL_HISTOGRAM_SIZE + a];
+        for (b = 0; b < HLL_HISTOGRAM_SIZE; b++) {
+            if (a == b || (n = pairs[a * HLL_HISTOGRAM_SIZE + b]) == 0)
+                continue;
+            if (a < b) {
+                joint->less1[a] += n;
+                joint->less2[b] += n;
+            } else {
+                joint->greater1[a] += n;
+                joint->greater2[b] += n;
+            }
+        }
+    }
+}
+
+#ifdef HLL_AVX2
+__attribute__((target("avx2")))
+static uint32_t
+merge_avx2(uint8_t *dst, const uint8_t *src, uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i + 64 <= size; i += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *) (dst + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *) (dst + i + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_max_epu8(a0, b0));
+        _mm256_storeu_si256((__m256i *) (dst + i + 32),
+                            _mm256_max_epu8(a1, b1));
+    }
+
+    return i;
+}
+#endif
+
+/* Sets each register to the maximum of itself and the register at the same
+ * index in other. */
+void hllMerge(char *registers, const char *other, uint32_t size)
+{
+    uint8_t *dst = (uint8_t *) registers;
+    const uint8_t *src = (const uint8_t *) other;
+    uint32_t i = 0;
+
+    #ifdef HLL_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        i = merge_avx2(dst, src, size);
+    #endif
+
+    #ifdef HLL_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_max_epu8(a, b));
+    }
+    #endif
+
+    for (; i < size; i++) {
+        if (dst[i] < src[i])
+            dst[i] = src[i];
+    }
+}
+
+#ifdef HLL_AVX2
+__attribute__((target("avx2")))
+static uint32_t
+merge4_avx2(uint8_t *dst, const uint8_t **src, uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src[0] + i));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (src[1] + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (src[2] + i));
+        __m256i e = _mm256_loadu_si256((const __m256i *) (src[3] + i));
+        a = _mm256_max_epu8(_mm256_max_epu8(a, b), _mm256_max_epu8(c, d));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_max_epu8(a, e));
+    }
+
+    return i;
+}
+#endif
+
+/* Merges registers [offset, offset + size) of four register arrays into dst
+ * at once, so dst is loaded and stored once per four inputs. */
+static void
+merge4(char *registers, const char **others, uint32_t offset, uint32_t size)
+{
+    uint8_t *dst = (uint8_t *) registers;
+    const uint8_t *src[4];
+    uint32_t i = 0;
+    int j;
+
+    for (j = 0; j < 4; j++)
+        src[j] = (const uint8_t *) others[j] + offset;
+
+    #ifdef HLL_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        i = merge4_avx2(dst, src, size);
+    #endif
+
+    #ifdef HLL_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src[0] + i));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src[1] + i));
+        __m128i d = _mm_loadu_si128((const __m128i *) (src[2] + i));
+        __m128i e = _mm_loadu_si128((const __m128i *) (src[3] + i));
+        a = _mm_max_epu8(_mm_max_epu8(a, b), _mm_max_epu8(c, d));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_max_epu8(a, e));
+    }
+    #endif
+
+    for (; i < size; i++) {
+        for (j = 0; j < 4; j++) {
+            if (dst[i] < src[j][i])
+                dst[i] = src[j][i];
+        }
+    }
+}
+
+/* Merges other into registers like hllMerge(), but with an atomic max for
+ * each register that increases, so registers can be updated concurrently.
+ * SSE2 finds the registers that need an update 16 at a time. */
+void hllMergeAtomic(char *registers, const char *other, uint32_t size)
+{
+    const uint8_t *src = (const uint8_t *) other;
+    uint32_t i = 0, j;
+
+    #ifdef HLL_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (registers + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+        int same = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(a, b), a));
+
+        if (same == 0xFFFF)
+            continue;
+
+        for (j = 0; j < 16; j++) {
+            if (!(same & (1 << j)))
+                hllAtomicMax(registers + i + j, src[i + j]);
+        }
+    }
+    #endif
+
+    for (; i < size; i++)
+        hllAtomicMax(registers + i, src[i]);
+}
+
+/* Copies pickled registers, where empty registers are stored as
+ * HLL_ZERO_BYTE, into registers. Unpickled registers, which never contain
+ * HLL_ZERO_BYTE, are copied unchanged. */
+void hllDecode(char *registers, const char *encoded, uint32_t size)
+{
+    uint8_t *dst = (uint8_t *) registers;
+    const uint8_t *src = (const uint8_t *) encoded;
+    uint32_t i = 0;
+
+    #ifdef HLL_SSE2
+    __m128i zero = _mm_set1_epi8(HLL_ZERO_BYTE);
+    for (; i + 16 <= size; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+        b = _mm_andnot_si128(_mm_cmpeq_epi8(b, zero), b);
+        _mm_storeu_si128((__m128i *) (dst + i), b);
+    }
+    #endif
+
+    for (; i < size; i++)
+        dst[i] = src[i] == HLL_ZERO_BYTE ? 0 : src[i];
+}
+
+/* Merges pickled or unpickled registers into registers without decoding
+ * them first, see hllDecode(). */
+void hllMergeEncoded(char *registers, const char *encoded, uint32_t size)
+{
+    uint8_t *dst = (uint8_t *) registers;
+    const uint8_t *src = (const uint8_t *) encoded;
+    uint32_t i = 0;
+    uint8_t r;
+
+    #ifdef HLL_SSE2
+    __m128i zero = _mm_set1_epi8(HLL_ZERO_BYTE);
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+        b = _mm_andnot_si128(_mm_cmpeq_epi8(b, zero), b);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_max_epu8(a, b));
+    }
+    #endif
+
+    for (; i < size; i++) {
+        r = src[i] == HLL_ZERO_BYTE ? 0 : src[i];
+        if (dst[i] < r)
+            dst[i] = r;
+    }
+}
+
+typedef struct {
+    char *registers;
+    const char **others;
+    size_t count;
+    uint32_t start;
+    uint32_t end;
+} MergeRange;
+
+/* Merges every input into registers [start, end) one block at a time, so
+ * the destination block stays in cache while the inputs stream past it. */
+static void *
+merge_range(void *arg)
+{
+    MergeRange *range = (MergeRange *) arg;
+    uint32_t block, length;
+    size_t i;
+
+    for (block = range->start; block < range->end; block += length) {
+        length = range->end - block;
+        if (length > HLL_MERGE_BLOCK)
+            length = HLL_MERGE_BLOCK;
+
+        for (i = 0; i + 4 <= range->count; i += 4)
+            merge4(range->registers + block, range->others + i, block,
+                   length);
+        for (; i < range->count; i++)
+            hllMerge(range->registers + block, range->others[i] + block,
+                     length);
+    }
+
+    return NULL;
+}
+
+/* Merges count register arrays into registers. The registers are split into
+ * up to threads contiguous ranges of whole blocks, merged in parallel, see
+ * hllRunTasks(). */
+void hllMergeMany(char *registers, const char **others, size_t count,
+                  uint32_t size, int threads)
+{
+    uint32_t blocks = (size + HLL_MERGE_BLOCK - 1) / HLL_MERGE_BLOCK;
+    MergeRange *ranges;
+    int i;
+
+    if (threads > (int) blocks)
+        threads = blocks;
+
+    if (threads <= 1) {
+        MergeRange range = {registers, others, count, 0, size};
+        merge_range(&range);
+        return;
+    }
+
+    ranges = (MergeRange *) malloc(threads * sizeof(MergeRange));
+    if (ranges == NULL) {
+        MergeRange range = {registers, others, count, 0, size};
+        merge_range(&range);
+        return;
+    }
+
+    for (i = 0; i < threads; i++) {
+        ranges[i].registers = registers;
+        ranges[i].others = others;
+        ranges[i].count = count;
+        ranges[i].start = (uint32_t) ((uint64_t) blocks * i / threads)
+                          * HLL_MERGE_BLOCK;
+        ranges[i].end = (uint32_t) ((uint64_t) blocks * (i + 1) / threads)
+                        * HLL_MERGE_BLOCK;
+        if (ranges[i].end > size)
+            ranges[i].end = size;
+    }
+
+    hllRunTasks(merge_range, ranges, sizeof(MergeRange), threads);
+    free(ranges);
+}
+
+/* Counts the number of registers with each rank in the union of count
+ * register arrays, without writing the union anywhere. Each block of the
+ * union is built in a small stack buffer and counted while still in cache.
+ */
+void hllUnionHistogram(const char **registers, size_t count, uint32_t size,
+                       uint32_t *counts)
+{
+    char block[HLL_UNION_BLOCK] __attribute__ ((aligned (32)));
+    uint32_t sub[4][256];
+    uint32_t start, length;
+    size_t i;
+
+    memset(sub, 0, sizeof(sub));
+    for (start = 0; count > 0 && start < size; start += length) {
+        length = size - start;
+        if (length > HLL_UNION_BLOCK)
+            length = HLL_UNION_BLOCK;
+
+        memcpy(block, registers[0] + start, length);
+        for (i = 1; i + 4 <= count; i += 4)
+            merge4(block, registers + i, start, length);
+        for (; i < count; i++)
+            hllMerge(block, registers[i] + start, length);
+
+        count_ranks((const uint8_t *) block, length, sub);
+    }
+    fold_ranks(sub, counts);
+}
+
+/* Merges the registers of a sketch with 2^otherK registers into a sketch
+ * with 2^k registers, where otherK >= k.
+ *
+ * Register i of the smaller sketch covers registers i << w to
+ * ((i + 1) << w) - 1 of the larger one, where w = otherK - k. The low w bits
+ * of the larger index become the leading bits of the hash suffix ranked by
+ * the smaller sketch. So when those bits, j, are not all zero the rank is
+ * the number of leading zeros of j in w bits plus 1, otherwise it is w plus
+ * the rank in the larger sketch. Empty registers contribute nothing.
+ */
+void hllFold(char *registers, short int k, const char *other, short int otherK)
+{
+    const uint8_t *src = (const uint8_t *) other;
+    uint8_t *dst = (uint8_t *) registers;
+    uint32_t i, j, size = 1 << k, w = otherK - k, span = 1 << w;
+    uint8_t rank;
+
+    if (w == 0) {
+        hllMerge(registers, other, size);
+        return;
+    }
+
+    for (i = 0; i < size; i++, src += span) {
+        rank = dst[i];
+
+        if (src[0] != 0 && w + src[0] > rank)
+            rank = w + src[0];
+
+        /* Ranks only decrease with j, so stop at the first non-empty one. */
+        for (j = 1; j < span; j++) {
+            if (src[j] != 0) {
+                uint8_t r = (uint8_t) (w - (32 - __builtin_clz(j)) + 1);
+                if (r > rank)
+                    rank = r;
+                break;
+            }
+        }
+
+        dst[i] = rank;
+    }
+}
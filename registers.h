@@ -0,0 +1,63 @@
+#ifndef _HLL_REGISTERS_H_
+#define _HLL_REGISTERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pickled registers store empty registers as this byte, see hllDecode(). */
+#define HLL_ZERO_BYTE 'z'
+
+/* Number of bins in a register histogram. Ranks above the last bin are
+ * counted in the last bin. */
+#define HLL_HISTOGRAM_SIZE 64
+
+/* Registers merged from every input before moving on, sized to stay in L1. */
+#define HLL_MERGE_BLOCK 16384
+
+/* Size of the stack buffer holding one block of a union being counted. */
+#define HLL_UNION_BLOCK 2048
+
+/* Histograms of the register pairs of two sketches, see hllJointHistogram(). */
+typedef struct {
+    uint32_t less1[HLL_HISTOGRAM_SIZE];    /* first rank, first < second */
+    uint32_t less2[HLL_HISTOGRAM_SIZE];    /* second rank, first < second */
+    uint32_t greater1[HLL_HISTOGRAM_SIZE]; /* first rank, first > second */
+    uint32_t greater2[HLL_HISTOGRAM_SIZE]; /* second rank, first > second */
+    uint32_t equal[HLL_HISTOGRAM_SIZE];    /* rank, first == second */
+} JointHistogram;
+
+/* Sets a register to rank if that is larger, atomically. Registers only ever
+ * increase, so a compare-and-swap loop that gives up once the register is at
+ * least rank never loses a concurrent update. */
+static inline void
+hllAtomicMax(char *reg, uint8_t rank)
+{
+    uint8_t current = __atomic_load_n((uint8_t *) reg, __ATOMIC_RELAXED);
+
+    while (current < rank &&
+           !__atomic_compare_exchange_n((uint8_t *) reg, &current, rank, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void hllHistogram(const char *registers, uint32_t size, uint32_t *counts);
+
+void hllJointHistogram(const char *registers, const char *other,
+                       uint32_t size, JointHistogram *joint);
+
+void hllMerge(char *registers, const char *other, uint32_t size);
+
+void hllMergeAtomic(char *registers, const char *other, uint32_t size);
+
+void hllDecode(char *registers, const char *encoded, uint32_t size);
+
+void hllMergeEncoded(char *registers, const char *encoded, uint32_t size);
+
+void hllUnionHistogram(const char **registers, size_t count, uint32_t size,
+                       uint32_t *counts);
+
+void hllFold(char *registers, short int k, const char *other, short int otherK);
+
+void hllMergeMany(char *registers, const char **others, size_t count,
+                  uint32_t size, int threads);
+
+#endif // _HLL_REGISTERS_H_
@@ -9,9 +9,12 @@ setup(
     maintainer='Joshua Andersen',
     url='https://github.com/ascv/HyperLogLog',
     ext_modules=[
-        Extension('HLL', ['hll.c', 'murmur3.c']),
+        Extension('HLL', ['hll.c', 'array.c', 'batch.c', 'estimate.c',
+                          'estimatebuffer.c', 'explicit.c', 'grouped.c',
+                          'hash.c', 'hashbuffer.c', 'ingestor.c', 'murmur3.c',
+                          'pool.c', 'registers.c', 'sharded.c']),
     ],
-    headers=['hll.h', 'murmur3.h'],
+    headers=['batch.h', 'const.h', 'estimate.h', 'explicit.h', 'hash.h', 'hll.h', 'murmur3.h', 'pool.h', 'registers.h'],
     keywords=['HyperLogLog', 'Hyper LogLog', 'LogLog', 'cardinality', 'probablistic counting'],
     long_description=\
 """
@@ -0,0 +1,353 @@
+#include "hll.h"
+#include "estimate.h"
+#include "hash.h"
+#include "registers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Shards are aligned and padded to this size so no two shards share a cache
+ * line. */
+#define HLL_CACHE_LINE 64
+
+/* Each shard is a cache line holding its version followed by its registers.
+ * The version counts register updates so cardinality() knows when the
+ * cached histogram of the union is stale. */
+typedef struct {
+    PyObject_HEAD
+    short int k;        /* size = 2^k */
+    uint32_t seed;      /* hash seed */
+    int hash;           /* hash function, see hash.h */
+    uint32_t size;      /* number of registers per shard */
+    uint32_t shards;    /* number of shards */
+    uint32_t stride;    /* bytes between shards */
+    char *memory;       /* shards * stride bytes */
+    const char **registers; /* registers of each shard */
+    uint64_t version;   /* sum of the shard versions when cached */
+    int cached;         /* counts holds the histogram of the union */
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+} ShardedHyperLogLog;
+
+/* Threads are numbered on their first add, a thread always adds to shard
+ * number % shards. */
+static __thread int64_t threadNumber = -1;
+static uint32_t nextThreadNumber = 0;
+
+static inline uint32_t *
+shard_version(ShardedHyperLogLog *self, uint32_t shard)
+{
+    return (uint32_t *) (self->memory + (size_t) shard * self->stride);
+}
+
+/* Sums the versions of all shards. */
+static uint64_t
+total_version(ShardedHyperLogLog *self)
+{
+    uint64_t version = 0;
+    uint32_t i;
+
+    for (i = 0; i < self->shards; i++)
+        version += __atomic_load_n(shard_version(self, i), __ATOMIC_ACQUIRE);
+
+    return version;
+}
+
+static void
+ShardedHyperLogLog_dealloc(ShardedHyperLogLog *self)
+{
+    free(self->memory);
+    free(self->registers);
+    #if PY_MAJOR_VERSION >= 3
+    Py_TYPE(self)->tp_free((PyObject*) self);
+    #else
+    self->ob_type->tp_free((PyObject*) self);
+    #endif
+}
+
+static PyObject *
+ShardedHyperLogLog_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    ShardedHyperLogLog *self;
+    self = (ShardedHyperLogLog *)type->tp_alloc(type, 0);
+    self->seed = 314;
+    return (PyObject *)self;
+}
+
+static int
+ShardedHyperLogLog_init(ShardedHyperLogLog *self, PyObject *args,
+                        PyObject *kwds)
+{
+    static char *kwlist[] = {"k", "shards", "seed", "hash", NULL};
+    const char *hash = NULL;
+    int k, shards = 0, hashId = HLL_HASH_MURMUR3;
+    uint32_t i, seed = 314;
+    void *memory;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|iIs", kwlist,
+                                     &k, &shards, &seed, &hash))
+        return -1;
+
+    if (hash != NULL && (hashId = hllHashFromName(hash)) < 0) {
+        PyErr_Format(PyExc_ValueError, "Unknown hash '%s'.", hash);
+        return -1;
+    }
+
+    if (k < 2 || k > 16) {
+        char * msg = "Number of registers must be in the range [2^2, 2^16]";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    if (shards == 0)
+        shards = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (shards < 1 || shards > 4096) {
+        char * msg = "Number of shards must be in the range [1, 4096]";
+        PyErr_SetString(PyExc_ValueError, msg);
+        return -1;
+    }
+
+    if (self->memory != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Already initialized.");
+        return -1;
+    }
+
+    self->k = k;
+    self->seed = seed;
+    self->hash = hashId;
+    self->size = 1 << k;
+    self->shards = shards;
+    self->stride = HLL_CACHE_LINE +
+        (self->size + HLL_CACHE_LINE - 1) / HLL_CACHE_LINE * HLL_CACHE_LINE;
+
+    if (posix_memalign(&memory, HLL_CACHE_LINE,
+                       (size_t) self->shards * self->stride) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(memory, 0, (size_t) self->shards * self->stride);
+    self->memory = (char *) memory;
+
+    self->registers = (const char **) malloc(shards * sizeof(char *));
+    if (self->registers == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < self->shards; i++)
+        self->registers[i] = (char *) shard_version(self, i) + HLL_CACHE_LINE;
+
+    return 0;
+}
+
+/* Adds an element to the calling thread's shard, without locks. */
+static PyObject *
+ShardedHyperLogLog_add(ShardedHyperLogLog *self, PyObject *key)
+{
+    const char *data;
+    Py_ssize_t dataLength;
+    uint32_t hash, index, rank, shard;
+    char *reg;
+
+    if (!hllKeyData(key, &data, &dataLength))
+        return NULL;
+
+    hash = hllHash(self->hash, data, dataLength, self->seed);
+    index = hllIndex(hash, self->k);
+    rank = hllRank(hash, self->k);
+
+    if (threadNumber < 0)
+        threadNumber = __atomic_fetch_add(&nextThreadNumber, 1,
+                                          __ATOMIC_RELAXED);
+    shard = threadNumber % self->shards;
+
+    reg = (char *) self->registers[shard] + index;
+    if ((uint8_t) *reg < rank) {
+        hllAtomicMax(reg, rank);
+        __atomic_fetch_add(shard_version(self, shard), 1, __ATOMIC_RELEASE);
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Gets a cardinality estimate of the union of the shards. The histogram of
+ * the union is computed with one fused max and count pass over all shards,
+ * and is reused until a register changes.
+ */
+static PyObject *
+ShardedHyperLogLog_cardinality(ShardedHyperLogLog *self, PyObject *args,
+                               PyObject *kwds)
+{
+    static char *kwlist[] = {"estimator", NULL};
+    const char *name = NULL;
+    uint32_t counts[HLL_HISTOGRAM_SIZE];
+    uint64_t version;
+    int estimator, cached = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &name))
+        return NULL;
+
+    estimator = name == NULL ? HLL_ESTIMATOR_CORRECTED
+                             : hllEstimatorFromName(name);
+    if (estimator < 0) {
+        PyErr_Format(PyExc_ValueError, "Unknown estimator '%s'.", name);
+        return NULL;
+    }
+
+    /* Read the versions before the registers, so an update racing with the
+     * scan leaves the cache stale rather than wrong. */
+    version = total_version(self);
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->cached && self->version == version) {
+        memcpy(counts, self->counts, sizeof(counts));
+        cached = 1;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (!cached) {
+        if ((uint64_t) self->shards * self->size >= HLL_NOGIL_SIZE) {
+            Py_BEGIN_ALLOW_THREADS
+            hllUnionHistogram(self->registers, self->shards, self->size,
+                              counts);
+            Py_END_ALLOW_THREADS
+        } else {
+            hllUnionHistogram(self->registers, self->shards, self->size,
+                              counts);
+        }
+
+        Py_BEGIN_CRITICAL_SECTION(self);
+        memcpy(self->counts, counts, sizeof(counts));
+        self->version = version;
+        self->cached = 1;
+        Py_END_CRITICAL_SECTION();
+    }
+
+    return Py_BuildValue("d", hllEstimate(counts, self->k, estimator));
+}
+
+/* Gets a HyperLogLog with the union of the shards. */
+static PyObject *
+ShardedHyperLogLog_merged(ShardedHyperLogLog *self)
+{
+    HyperLogLog *hll;
+
+    hll = (HyperLogLog *) PyObject_CallFunction((PyObject *) &HyperLogLogType,
+                                                "iIis", self->k, self->seed,
+                                                HLL_THREADSAFE_DEFAULT,
+                                                hllHashName(self->hash));
+    if (hll == NULL)
+        return NULL;
+
+    if (hllOwnRegisters(hll) < 0) {
+        Py_DECREF(hll);
+        return NULL;
+    }
+
+    hllMergeMany(hll->registers, self->registers, self->shards, self->size, 1);
+    return (PyObject *) hll;
+}
+
+/* Gets the name of the hash function. */
+static PyObject *
+ShardedHyperLogLog_hash(ShardedHyperLogLog *self)
+{
+    #if PY_MAJOR_VERSION >= 3
+    return PyUnicode_FromString(hllHashName(self->hash));
+    #else
+    return PyString_FromString(hllHashName(self->hash));
+    #endif
+}
+
+/* Gets the seed value used in the hash. */
+static PyObject *
+ShardedHyperLogLog_seed(ShardedHyperLogLog *self)
+{
+    return Py_BuildValue("I", self->seed);
+}
+
+/* Gets the number of shards. */
+static PyObject *
+ShardedHyperLogLog_shards(ShardedHyperLogLog *self)
+{
+    return Py_BuildValue("I", self->shards);
+}
+
+/* Gets the number of registers in each shard. */
+static PyObject *
+ShardedHyperLogLog_size(ShardedHyperLogLog *self)
+{
+    return Py_BuildValue("I", self->size);
+}
+
+static PyMethodDef ShardedHyperLogLog_methods[] = {
+    {"add", (PyCFunction)ShardedHyperLogLog_add, METH_O,
+     "Add an element to the calling thread's shard."
+    },
+    {"cardinality", (PyCFunction)ShardedHyperLogLog_cardinality,
+     METH_VARARGS | METH_KEYWORDS,
+     "Get the cardinality of the union of the shards."
+    },
+    {"hash", (PyCFunction)ShardedHyperLogLog_hash, METH_NOARGS,
+     "Get the name of the hash function."
+    },
+    {"merged", (PyCFunction)ShardedHyperLogLog_merged, METH_NOARGS,
+     "Get a HyperLogLog with the union of the shards."
+    },
+    {"seed", (PyCFunction)ShardedHyperLogLog_seed, METH_NOARGS,
+     "Get the seed used in the hash."
+    },
+    {"shards", (PyCFunction)ShardedHyperLogLog_shards, METH_NOARGS,
+     "Returns the number of shards."
+    },
+    {"size", (PyCFunction)ShardedHyperLogLog_size, METH_NOARGS,
+     "Returns the number of registers in each shard."
+    },
+    {NULL}  /* Sentinel */
+};
+
+PyTypeObject ShardedHyperLogLogType = {
+    #if PY_MAJOR_VERSION >= 3
+    PyVarObject_HEAD_INIT(NULL, 0)
+    #else
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    #endif
+    "HLL.ShardedHyperLogLog",  /*tp_name*/
+    sizeof(ShardedHyperLogLog), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)ShardedHyperLogLog_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT |
+        Py_TPFLAGS_BASETYPE,   /*tp_flags*/
+    "HyperLogLog with a register array per thread", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    ShardedHyperLogLog_methods, /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)ShardedHyperLogLog_init, /* tp_init */
+    0,                         /* tp_alloc */
+    ShardedHyperLogLog_new,    /* tp_new */
+};
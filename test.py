@@ -1,6 +1,15 @@
-from HLL import HyperLogLog
+from HLL import (AsyncIngestor, GroupedHyperLogLog, HyperLogLog,
+                 HyperLogLogArray, ShardedHyperLogLog)
+from functools import reduce
 from random import randint
+import array
+import copy
+import operator
+import os
 import pickle
+import struct
+import threading
+import time
 import unittest
 import sys
 
@@ -28,6 +37,75 @@ class TestAdd(unittest.TestCase):
         except Exception as ex:
             self.fail('failed to add bytes: %s' % ex)
 
+    @unittest.skipIf(sys.version_info[0] < 3, 'str is bytes in python 2.x')
+    def test_str_hashes_as_utf8(self):
+        class Key(str):
+            pass
+
+        keys = ['ascii', 'caf\xe9', '\u4e2d\u6587', '\U0001f600', '']
+        hll, many, expected = HyperLogLog(10), HyperLogLog(10), HyperLogLog(10)
+        for key in keys:
+            hll.add(key)
+            hll.add(Key(key))
+            expected.add(key.encode('utf-8'))
+        many.add_many(keys)
+        self.assertEqual(hll.registers(), expected.registers())
+        self.assertEqual(many.registers(), expected.registers())
+
+    def test_add_many_matches_add(self):
+        data = [str(i) for i in range(50000)] + [b'bytes']
+        for k, threads, threadsafe in ((5, 1, False), (12, 4, False),
+                                       (12, 3, True), (2, 8, False)):
+            expected = HyperLogLog(k)
+            for item in data:
+                expected.add(item)
+            hll = HyperLogLog(k, threadsafe=threadsafe)
+            hll.add_many(iter(data), threads=threads)
+            self.assertEqual(hll.registers(), expected.registers())
+
+    def test_add_many_invalid_arguments_fail(self):
+        with self.assertRaises(TypeError):
+            self.hll.add_many(['a', 1])
+        with self.assertRaises(ValueError):
+            self.hll.add_many(['a'], threads=0)
+
+    def test_add_tuple_encoding(self):
+        hll, expected = HyperLogLog(10), HyperLogLog(10)
+        hll.add_tuple((u'ab', b'c', -2))
+        expected.add(b's\x02\x00\x00\x00ab' + b's\x01\x00\x00\x00c' +
+                     b'i\x08\x00\x00\x00' + struct.pack('<q', -2))
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_add_tuple_keeps_field_boundaries(self):
+        hll = HyperLogLog(10)
+        hll.add_tuple(('ab', 'c'))
+        hll.add_tuple(('a', 'bc'))
+        hll.add_tuple(('abc',))
+        hll.add_tuple(('1',))
+        hll.add_tuple((1,))
+        hll.add_tuple(('a', 'bc'))
+        self.assertEqual(hll.cardinality(), 5)
+
+    def test_add_tuples_matches_add_tuple(self):
+        rows = [(i, 'item%d' % (i % 100), b'day') for i in range(20000)]
+        for k, threads in ((5, 1), (12, 4)):
+            expected = HyperLogLog(k)
+            for row in rows:
+                expected.add_tuple(row)
+            hll = HyperLogLog(k)
+            hll.add_tuples(iter(rows), threads=threads)
+            self.assertEqual(hll.registers(), expected.registers())
+
+    def test_add_tuple_invalid_fields_fail(self):
+        with self.assertRaises(TypeError):
+            self.hll.add_tuple(('a', 1.5))
+        with self.assertRaises(TypeError):
+            self.hll.add_tuple(5)
+        with self.assertRaises(OverflowError):
+            self.hll.add_tuple((2 ** 64,))
+        with self.assertRaises(TypeError):
+            self.hll.add_tuples([('a',), None])
+
 class TestCardinalityEstimation(unittest.TestCase):
 
     def setUp(self):
@@ -59,6 +137,82 @@ class TestCardinalityEstimation(unittest.TestCase):
         correction = 1548966270 <= c and c <= 1548966271
         self.assertTrue(correction)
  
+class TestEstimators(unittest.TestCase):
+
+    def setUp(self):
+        self.hll = HyperLogLog(10)
+        for i in range(5000):
+            self.hll.add(str(i))
+
+    def test_histogram_counts_every_register(self):
+        histogram = self.hll.register_histogram()
+        self.assertEqual(len(histogram), 32 - 10 + 2)
+        self.assertEqual(sum(histogram), self.hll.size())
+
+    def test_histogram_of_empty_sketch(self):
+        histogram = HyperLogLog(5).register_histogram()
+        self.assertEqual(histogram[0], 32)
+        self.assertEqual(sum(histogram[1:]), 0)
+
+    def test_estimate_matches_cardinality(self):
+        histogram = self.hll.register_histogram()
+        for estimator in ('corrected', 'raw', 'linear', 'improved', 'mle'):
+            self.assertEqual(self.hll.estimate(histogram, estimator),
+                             self.hll.cardinality(estimator))
+
+    def test_default_estimator_is_corrected(self):
+        self.assertEqual(self.hll.cardinality(),
+                         self.hll.cardinality('corrected'))
+
+    def test_improved_estimator_accuracy(self):
+        c = self.hll.cardinality('improved')
+        self.assertTrue(4500 <= c and c <= 5500)
+
+    def test_mle_estimator_accuracy(self):
+        c = self.hll.cardinality('mle')
+        self.assertTrue(4500 <= c and c <= 5500)
+
+    def test_mle_estimator_of_merged_sketches(self):
+        hll = HyperLogLog(10)
+        for i in range(20):
+            part = HyperLogLog(10)
+            for j in range(i * 1000, (i + 1) * 1000):
+                part.add(str(j))
+            hll.merge(part)
+        c = hll.cardinality('mle')
+        self.assertTrue(18000 <= c and c <= 22000)
+
+    def test_mle_estimator_of_empty_sketch(self):
+        self.assertEqual(HyperLogLog(5).cardinality('mle'), 0.0)
+
+    def test_cardinality_with_error(self):
+        c, error, lower, upper = self.hll.cardinality_with_error()
+        self.assertEqual(c, self.hll.cardinality())
+        self.assertTrue(0 < error and error < c)
+        self.assertTrue(lower < c and c < upper)
+        self.assertTrue(lower <= 5000 and 5000 <= upper)
+
+    def test_wider_confidence_gives_wider_interval(self):
+        _, _, lower, upper = self.hll.cardinality_with_error('mle', 0.9)
+        _, _, lower2, upper2 = self.hll.cardinality_with_error('mle', 0.99)
+        self.assertTrue(lower2 < lower and upper < upper2)
+
+    def test_cardinality_with_error_of_empty_sketch(self):
+        hll = HyperLogLog(5)
+        self.assertEqual(hll.cardinality_with_error(), (0.0, 0.0, 0.0, 0.0))
+
+    def test_invalid_confidence_fails(self):
+        with self.assertRaises(ValueError):
+            self.hll.cardinality_with_error('corrected', 1.0)
+
+    def test_unknown_estimator_fails(self):
+        with self.assertRaises(ValueError):
+            self.hll.cardinality('unknown')
+
+    def test_estimate_with_wrong_histogram_total_fails(self):
+        with self.assertRaises(ValueError):
+            self.hll.estimate([1, 2, 3])
+
 class TestHyperLogLogConstructor(unittest.TestCase):
 
     def test_one_is_invalid_size(self):
@@ -103,13 +257,52 @@ class TestHyperLogLogConstructor(unittest.TestCase):
         hll2 = HyperLogLog(5, seed=2)
         self.assertNotEqual(hll.murmur3_hash('test'), hll2.murmur3_hash('test'))
 
+    def test_seeds_above_2_31_are_valid(self):
+        seed = 2 ** 31 + 5
+        hll = HyperLogLog(10, seed)
+        hll.add('test')
+        self.assertEqual(hll.seed(), seed)
+        self.assertEqual(pickle.loads(pickle.dumps(hll)).seed(), seed)
+        self.assertEqual((hll | HyperLogLog(10, seed)).seed(), seed)
+        self.assertEqual(HyperLogLog.union([hll, hll]).seed(), seed)
+        sharded = ShardedHyperLogLog(10, seed=seed)
+        self.assertEqual(sharded.merged().seed(), seed)
+        self.assertEqual(HyperLogLogArray(2, 10, seed).get(1).seed(), seed)
+        self.assertEqual(HyperLogLogArray(2, 10, seed).merged().seed(), seed)
+
 class TestMerging(unittest.TestCase):
 
-    def test_only_same_size_HyperLogLogs_can_be_merged(self):
-        hll = HyperLogLog(4)
-        hll2 = HyperLogLog(5)
+    def test_smaller_HyperLogLogs_cannot_be_merged(self):
+        hll = HyperLogLog(5)
+        hll2 = HyperLogLog(4)
         with self.assertRaises(ValueError):
             hll.merge(hll2)
+
+    def test_merge_folds_larger_HyperLogLogs(self):
+        hll = HyperLogLog(12)
+        expected = HyperLogLog(8)
+        for i in range(10000):
+            hll.add(str(i))
+            expected.add(str(i))
+
+        hll2 = HyperLogLog(8)
+        hll2.merge(hll)
+        self.assertEqual(hll2.registers(), expected.registers())
+
+    def test_reduce_precision(self):
+        hll = HyperLogLog(12)
+        expected = HyperLogLog(6)
+        for i in range(10000):
+            hll.add(str(i))
+            expected.add(str(i))
+
+        hll.reduce_precision(6)
+        self.assertEqual(hll.size(), 64)
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_reduce_precision_cannot_increase_precision(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog(6).reduce_precision(7)
              
     def test_merge(self):
         expected = bytearray(4)
@@ -125,6 +318,954 @@ class TestMerging(unittest.TestCase):
         hll.merge(hll2)
         self.assertEqual(hll.registers(), expected)
 
+    def test_merge_takes_register_maximum(self):
+        hll = HyperLogLog(16)
+        hll2 = HyperLogLog(16)
+        regs = bytearray(randint(0, 17) for x in range(hll.size()))
+        regs2 = bytearray(randint(0, 17) for x in range(hll.size()))
+        hll.set_registers(regs)
+        hll2.set_registers(regs2)
+
+        hll.merge(hll2)
+        expected = bytearray(max(a, b) for a, b in zip(regs, regs2))
+        self.assertEqual(hll.registers(), expected)
+        self.assertEqual(hll2.registers(), regs2)
+
+    def test_merge_bytes(self):
+        hll = HyperLogLog(10)
+        hll2 = HyperLogLog(10)
+        for i in range(3000):
+            hll.add(str(i))
+            hll2.add(str(i + 2000))
+        expected = HyperLogLog.union([hll, hll2])
+
+        hll.merge_bytes(hll2.registers())
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_merge_bytes_many_decodes_pickled_and_larger_registers(self):
+        hlls = [HyperLogLog(k) for k in (10, 12, 14)]
+        for n, hll in enumerate(hlls):
+            for i in range(3000):
+                hll.add(str(i + n * 2000))
+        expected = HyperLogLog.union(hlls)
+
+        hll = HyperLogLog(10)
+        hll.merge_bytes_many([hlls[0].__reduce__()[2],
+                              bytes(hlls[1].registers()),
+                              hlls[2].registers()])
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_merge_bytes_with_invalid_length_fails(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog(5).merge_bytes(bytearray(31))
+        with self.assertRaises(ValueError):
+            HyperLogLog(5).merge_bytes(bytearray(16))
+
+    def test_only_HyperLogLogs_can_be_merged(self):
+        hll = HyperLogLog(4)
+        with self.assertRaises(TypeError):
+            hll.merge(bytearray(16))
+
+    def test_only_same_seed_HyperLogLogs_can_be_merged(self):
+        hll = HyperLogLog(4, seed=1)
+        hll2 = HyperLogLog(4, seed=2)
+        with self.assertRaises(ValueError):
+            hll.merge(hll2)
+
+class TestUnion(unittest.TestCase):
+
+    def setUp(self):
+        self.hlls = [HyperLogLog(12, seed=7) for x in range(9)]
+        for hll in self.hlls:
+            hll.set_registers(bytearray(randint(0, 20) for x in range(4096)))
+        self.expected = HyperLogLog(12, seed=7)
+        for hll in self.hlls:
+            self.expected.merge(hll)
+
+    def test_union_creates_merged_HyperLogLog(self):
+        hll = HyperLogLog.union(self.hlls)
+        self.assertEqual(hll.registers(), self.expected.registers())
+        self.assertEqual(hll.seed(), 7)
+
+    def test_union_into_merges_in_place(self):
+        hll = HyperLogLog(12, seed=7)
+        hll.union_into(iter(self.hlls))
+        self.assertEqual(hll.registers(), self.expected.registers())
+
+    def test_union_with_threads(self):
+        hll = HyperLogLog(16)
+        hlls = [HyperLogLog(16) for x in range(5)]
+        for other in hlls:
+            other.set_registers(bytearray(randint(0, 20) for x in range(65536)))
+        hll.union_into(hlls, threads=4)
+        expected = HyperLogLog.union(hlls)
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_union_cardinality(self):
+        for estimator in ('corrected', 'improved', 'mle'):
+            self.assertEqual(HyperLogLog.union_cardinality(self.hlls, estimator),
+                             self.expected.cardinality(estimator))
+
+    def test_union_cardinality_leaves_inputs_unchanged(self):
+        registers = [hll.registers() for hll in self.hlls]
+        HyperLogLog.union_cardinality(self.hlls)
+        self.assertEqual([hll.registers() for hll in self.hlls], registers)
+
+    def test_union_cardinality_of_nothing_fails(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog.union_cardinality([])
+
+    def test_union_of_nothing_fails(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog.union([])
+
+    def test_union_of_different_sizes_has_smallest_size(self):
+        hll = HyperLogLog.union(self.hlls + [HyperLogLog(10, seed=7)])
+        self.assertEqual(hll.size(), 1024)
+
+        expected = HyperLogLog(10, seed=7)
+        expected.union_into(self.hlls)
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_union_into_smaller_HyperLogLog_fails(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog(5).union_into([HyperLogLog(4)])
+
+    def test_union_of_non_HyperLogLogs_fails(self):
+        with self.assertRaises(TypeError):
+            HyperLogLog(4).union_into([HyperLogLog(4), 'asdf'])
+
+class TestIntersection(unittest.TestCase):
+
+    def setUp(self):
+        self.a = HyperLogLog(12)
+        self.b = HyperLogLog(12)
+        for i in range(20000):
+            self.a.add(str(i))
+        for i in range(10000, 40000):
+            self.b.add(str(i))
+
+    def test_intersection_cardinality(self):
+        c = HyperLogLog.intersection_cardinality(self.a, self.b)
+        self.assertTrue(9000 <= c and c <= 11000)
+
+    def test_intersection_of_disjoint_HyperLogLogs(self):
+        c = HyperLogLog(12)
+        for i in range(50000, 70000):
+            c.add(str(i))
+        self.assertTrue(HyperLogLog.intersection_cardinality(self.a, c) < 1000)
+
+    def test_intersection_with_itself(self):
+        c = HyperLogLog.intersection_cardinality(self.a, self.a)
+        self.assertAlmostEqual(c, self.a.cardinality('mle'), delta=1.0)
+
+    def test_jaccard(self):
+        j = HyperLogLog.jaccard(self.a, self.b)
+        self.assertTrue(0.2 <= j and j <= 0.3)
+
+    def test_jaccard_of_empty_HyperLogLogs(self):
+        self.assertEqual(HyperLogLog.jaccard(HyperLogLog(4), HyperLogLog(4)), 0.0)
+
+    def test_intersection_of_different_sizes_fails(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog.intersection_cardinality(self.a, HyperLogLog(10))
+
+class TestOperators(unittest.TestCase):
+
+    def setUp(self):
+        self.a = HyperLogLog(10)
+        self.b = HyperLogLog(12)
+        for i in range(3000):
+            self.a.add(str(i))
+            self.b.add(str(i + 2000))
+
+    def test_or_creates_union(self):
+        registers = self.a.registers()
+        c = self.a | self.b
+        self.assertEqual(c.registers(), HyperLogLog.union([self.a, self.b]).registers())
+        self.assertEqual(self.a.registers(), registers)
+
+    def test_inplace_or_merges(self):
+        expected = HyperLogLog.union([self.a, self.b])
+        a = self.a
+        a |= self.b
+        self.assertTrue(a is self.a)
+        self.assertEqual(a.registers(), expected.registers())
+
+    def test_or_reduction(self):
+        hlls = [self.a, self.b, HyperLogLog(11)]
+        c = reduce(operator.or_, hlls)
+        self.assertEqual(c.registers(), HyperLogLog.union(hlls).registers())
+
+    def test_or_with_other_types_fails(self):
+        with self.assertRaises(TypeError):
+            self.a | 1
+
+class TestThreadSafety(unittest.TestCase):
+
+    def test_threadsafe_parameter_sets_threadsafe(self):
+        self.assertTrue(HyperLogLog(5, threadsafe=True).threadsafe())
+        self.assertFalse(HyperLogLog(5, threadsafe=False).threadsafe())
+
+    def test_concurrent_adds(self):
+        hll = HyperLogLog(10, threadsafe=True)
+        expected = HyperLogLog(10)
+        for i in range(20000):
+            expected.add(str(i))
+
+        def add(start):
+            for i in range(start, 20000, 4):
+                hll.add(str(i))
+
+        threads = [threading.Thread(target=add, args=(x,)) for x in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_concurrent_explicit_adds_and_snapshots(self):
+        hll = HyperLogLog(12, threadsafe=False)
+        snapshots = []
+
+        def add(start):
+            for i in range(start, 4000, 4):
+                hll.add(str(i))
+                if i % 100 == 0:
+                    snapshots.append(hll.snapshot())
+
+        threads = [threading.Thread(target=add, args=(x,)) for x in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        expected = HyperLogLog(12, threadsafe=False)
+        expected.add_many([str(i) for i in range(4000)])
+        self.assertEqual(hll.registers(), expected.registers())
+        for snapshot in snapshots:
+            self.assertLessEqual(snapshot.cardinality(), hll.cardinality())
+
+    def race_reduce_precision(self, hll, operation):
+        done = threading.Event()
+
+        def resize():
+            # Folding to the same precision still replaces the registers.
+            while not done.is_set():
+                try:
+                    hll.reduce_precision(16)
+                except ValueError:
+                    pass
+
+        thread = threading.Thread(target=resize)
+        thread.start()
+        operation()
+        done.set()
+        thread.join()
+
+    def test_reduce_precision_races_bulk_adds(self):
+        keys = [str(i) for i in range(200000)]
+        hll = HyperLogLog(16, threadsafe=False)
+        self.race_reduce_precision(hll, lambda: hll.add_many(keys))
+
+        expected = HyperLogLog(16, threadsafe=False)
+        expected.add_many(keys)
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_reduce_precision_races_merges(self):
+        source = HyperLogLog(16, threadsafe=False)
+        source.add_many([str(i) for i in range(200000)])
+        expected = source.copy()
+        folded = source.copy()
+        folded.reduce_precision(4)
+        merged, union = HyperLogLog(4), HyperLogLog(16, threadsafe=False)
+
+        def merge():
+            merged.merge(source)
+            union.union_into([source] * 400)
+
+        self.race_reduce_precision(source, merge)
+        self.assertEqual(merged.registers(), folded.registers())
+        self.assertEqual(union.registers(), expected.registers())
+
+    def test_adds_race_bulk_adds(self):
+        keys = [str(i) for i in range(400000)]
+        others = [str(-i) for i in range(1, 20000)]
+        expected = HyperLogLog(4, threadsafe=False)
+        expected.add_many(keys + others)
+
+        hll = HyperLogLog(4, threadsafe=False)
+        done = threading.Event()
+
+        def add():
+            while not done.is_set():
+                for key in others:
+                    hll.add(key)
+
+        thread = threading.Thread(target=add)
+        thread.start()
+        for _ in range(5):
+            hll.add_many(keys, threads=2)
+        done.set()
+        thread.join()
+        for key in others:
+            hll.add(key)
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_adds_race_merges(self):
+        others = [str(-i) for i in range(1, 20000)]
+        sources = [HyperLogLog(16) for _ in range(4)]
+        for n, source in enumerate(sources):
+            source.add_many([str(i) for i in range(n, 400000, 4)])
+        expected = HyperLogLog.union(sources)
+        expected.add_many(others)
+
+        hll = HyperLogLog(16, threadsafe=False)
+        done = threading.Event()
+
+        def add():
+            while not done.is_set():
+                for key in others:
+                    hll.add(key)
+
+        thread = threading.Thread(target=add)
+        thread.start()
+        for source in sources:
+            hll.merge(source)
+        hll.union_into(sources, threads=2)
+        done.set()
+        thread.join()
+        for key in others:
+            hll.add(key)
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_threadsafe_merges(self):
+        hlls = [HyperLogLog(k) for k in (10, 10, 12)]
+        for n, other in enumerate(hlls):
+            for i in range(3000):
+                other.add(str(i + n * 2000))
+        expected = HyperLogLog.union(hlls)
+
+        hll = HyperLogLog(10, threadsafe=True)
+        hll.merge(hlls[0])
+        hll |= hlls[2]
+        hll.union_into(hlls[1:])
+        hll.merge_bytes(hlls[1].registers())
+        self.assertEqual(hll.registers(), expected.registers())
+
+    def test_readers_see_whole_batches(self):
+        batches = [[str(i) for i in range(n * 50000, (n + 1) * 50000)]
+                   for n in range(6)]
+        expected = HyperLogLog(14)
+        states = set([expected.cardinality()])
+        for batch in batches:
+            expected.add_many(batch)
+            states.add(expected.cardinality())
+
+        hll = HyperLogLog(14)
+        seen = []
+        done = threading.Event()
+
+        def read():
+            while not done.is_set():
+                seen.append(hll.cardinality())
+
+        reader = threading.Thread(target=read)
+        reader.start()
+        for batch in batches:
+            hll.add_many(batch, threads=2)
+        done.set()
+        reader.join()
+        self.assertTrue(set(seen) <= states)
+
+    @unittest.skipUnless(hasattr(os, 'fork'), 'fork is not supported')
+    def test_threaded_adds_after_fork(self):
+        keys = [str(i) for i in range(100000)]
+        expected = HyperLogLog(14)
+        expected.add_many(keys)
+        HyperLogLog(14).add_many(keys, threads=4)
+
+        pid = os.fork()
+        if pid == 0:
+            hll = HyperLogLog(14)
+            hll.add_many(keys, threads=4)
+            os._exit(0 if hll.registers() == expected.registers() else 1)
+        self.assertEqual(os.waitpid(pid, 0)[1], 0)
+
+class TestSharded(unittest.TestCase):
+
+    def test_shards_default_to_at_least_one(self):
+        self.assertTrue(ShardedHyperLogLog(10).shards() >= 1)
+        self.assertEqual(ShardedHyperLogLog(10, shards=3).shards(), 3)
+
+    def test_invalid_shards_fail(self):
+        with self.assertRaises(ValueError):
+            ShardedHyperLogLog(10, shards=-1)
+
+    def test_init_twice_keeps_seed_and_hash(self):
+        sharded = ShardedHyperLogLog(10, shards=2, seed=5)
+        with self.assertRaises(RuntimeError):
+            sharded.__init__(10, shards=2, seed=7, hash='xxh3')
+        self.assertEqual(sharded.seed(), 5)
+        self.assertEqual(sharded.hash(), 'murmur3')
+
+    def test_cardinality_matches_union(self):
+        sharded = ShardedHyperLogLog(12, shards=4, seed=7)
+        hlls = [HyperLogLog(12, seed=7) for _ in range(4)]
+
+        def add(n):
+            for i in range(n, 30000, 4):
+                sharded.add(str(i))
+                hlls[n].add(str(i))
+
+        threads = [threading.Thread(target=add, args=(x,)) for x in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        union = HyperLogLog.union(hlls)
+        self.assertEqual(sharded.merged().registers(), union.registers())
+        self.assertEqual(sharded.merged().seed(), 7)
+        self.assertEqual(sharded.cardinality(), union.cardinality())
+        self.assertEqual(sharded.cardinality('mle'), union.cardinality('mle'))
+
+    def test_cardinality_sees_new_adds(self):
+        sharded = ShardedHyperLogLog(10, shards=2)
+        self.assertEqual(sharded.cardinality(), 0)
+        sharded.add('a')
+        self.assertEqual(round(sharded.cardinality()), 1)
+
+class TestGrouped(unittest.TestCase):
+
+    def setUp(self):
+        self.groups = ['g%d' % (i % 7) for i in range(20000)]
+        self.keys = [str(i % 3000) for i in range(20000)]
+        self.expected = {}
+        for group, key in zip(self.groups, self.keys):
+            hll = self.expected.setdefault(group.encode(), HyperLogLog(10))
+            hll.add(key)
+
+    def test_init_twice_keeps_seed_and_hash(self):
+        grouped = GroupedHyperLogLog(10, seed=5)
+        with self.assertRaises(RuntimeError):
+            grouped.__init__(10, seed=7, hash='xxh3')
+        self.assertEqual(grouped.seed(), 5)
+        self.assertEqual(grouped.hash(), 'murmur3')
+
+    def test_add_matches_a_hyperloglog_per_group(self):
+        grouped = GroupedHyperLogLog(10)
+        for group, key in zip(self.groups, self.keys):
+            grouped.add(group, key)
+        self.assertEqual(len(grouped), 7)
+        self.assertEqual(sorted(grouped.groups()), sorted(self.expected))
+        for group, hll in self.expected.items():
+            self.assertEqual(grouped.cardinality(group), hll.cardinality())
+            self.assertEqual(grouped.get(group).registers(), hll.registers())
+
+    def test_add_many_matches_add(self):
+        grouped = GroupedHyperLogLog(10)
+        grouped.add_many(self.groups, self.keys)
+        cardinalities = grouped.cardinalities('mle')
+        for group, hll in self.expected.items():
+            self.assertEqual(cardinalities[group], hll.cardinality('mle'))
+
+    def test_small_groups_are_exact(self):
+        grouped = GroupedHyperLogLog(12)
+        grouped.add_many(['a'] * 3 + ['b'], ['x', 'y', 'x', 'z'])
+        self.assertEqual(grouped.cardinality('a'), 2)
+        self.assertEqual(grouped.cardinality(b'b'), 1)
+        self.assertEqual(grouped.cardinality('missing'), 0)
+        self.assertEqual(grouped.get('a').cardinality(), 2)
+        with self.assertRaises(KeyError):
+            grouped.get('missing')
+
+    def test_merge_matches_adding_to_one(self):
+        first, second, both = [GroupedHyperLogLog(10) for _ in range(3)]
+        first.add_many(self.groups[:15000], self.keys[:15000])
+        second.add_many(['new'] + self.groups[15000:],
+                        ['x'] + self.keys[15000:])
+        both.add_many(self.groups + ['new'], self.keys + ['x'])
+        first.merge(second)
+        self.assertEqual(first.cardinalities(), both.cardinalities())
+        for group in both.groups():
+            self.assertEqual(first.get(group).registers(),
+                             both.get(group).registers())
+
+    def test_concurrent_adds_match_add_many(self):
+        grouped, expected = GroupedHyperLogLog(10), GroupedHyperLogLog(10)
+        expected.add_many(self.groups, self.keys)
+
+        def add(n):
+            grouped.add_many(self.groups[n::4], self.keys[n::4])
+
+        threads = [threading.Thread(target=add, args=(x,)) for x in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        self.assertEqual(grouped.cardinalities(), expected.cardinalities())
+
+    def test_invalid_arguments_fail(self):
+        grouped = GroupedHyperLogLog(10)
+        with self.assertRaises(ValueError):
+            grouped.add_many(['a', 'b'], ['x'])
+        with self.assertRaises(ValueError):
+            grouped.merge(GroupedHyperLogLog(11))
+        with self.assertRaises(ValueError):
+            grouped.merge(GroupedHyperLogLog(10, seed=1))
+        with self.assertRaises(TypeError):
+            grouped.merge(HyperLogLog(10))
+
+class TestArray(unittest.TestCase):
+
+    def setUp(self):
+        self.rows = [(i * 7) % 50 for i in range(20000)]
+        self.keys = [str(i) for i in range(20000)]
+        self.expected = [HyperLogLog(8) for _ in range(50)]
+        for row, key in zip(self.rows, self.keys):
+            self.expected[row].add(key)
+
+    def test_init_twice_keeps_seed_and_hash(self):
+        hlls = HyperLogLogArray(2, 8, seed=5)
+        with self.assertRaises(RuntimeError):
+            hlls.__init__(2, 8, seed=7, hash='xxh3')
+        self.assertEqual(hlls.seed(), 5)
+        self.assertEqual(hlls.hash(), 'murmur3')
+
+    def test_add_matches_a_hyperloglog_per_row(self):
+        hlls = HyperLogLogArray(50, 8)
+        hlls.add(self.rows, self.keys)
+        self.assertEqual(len(hlls), 50)
+        for row, hll in enumerate(self.expected):
+            self.assertEqual(hlls.get(row).registers(), hll.registers())
+
+    def test_rows_from_a_buffer(self):
+        hlls = HyperLogLogArray(50, 8)
+        hlls.add(bytearray(self.rows), self.keys)
+        for row in (0, 49):
+            self.assertEqual(hlls.get(row).registers(),
+                             self.expected[row].registers())
+
+    def test_add_hashes_matches_add(self):
+        hlls, expected = HyperLogLogArray(50, 8), HyperLogLogArray(50, 8)
+        hlls.add_hashes(self.rows, HyperLogLog(8).hash_many(self.keys))
+        expected.add(self.rows, self.keys)
+        self.assertEqual(list(hlls.cardinalities()),
+                         list(expected.cardinalities()))
+
+    def test_cardinalities(self):
+        hlls = HyperLogLogArray(50, 8)
+        hlls.add(self.rows, self.keys)
+        cardinalities = hlls.cardinalities('raw')
+        self.assertEqual(len(cardinalities), 50)
+        self.assertEqual(memoryview(cardinalities).format, 'd')
+        for row, hll in enumerate(self.expected):
+            self.assertEqual(cardinalities[row], hll.cardinality('raw'))
+            self.assertEqual(hlls.cardinality(row, 'raw'),
+                             hll.cardinality('raw'))
+
+    def test_merge_and_merged(self):
+        first, second, both = [HyperLogLogArray(50, 8) for _ in range(3)]
+        first.add(self.rows[:5000], self.keys[:5000])
+        second.add(self.rows[5000:], self.keys[5000:])
+        both.add(self.rows, self.keys)
+        first.merge(second)
+        self.assertEqual(list(first.cardinalities()),
+                         list(both.cardinalities()))
+        self.assertEqual(both.merged().registers(),
+                         HyperLogLog.union(self.expected).registers())
+        self.assertEqual(both.merged([3, 4]).registers(),
+                         (self.expected[3] | self.expected[4]).registers())
+
+    def test_concurrent_adds_and_merges(self):
+        hlls, other, expected = [HyperLogLogArray(50, 8) for _ in range(3)]
+        batches = [[key + str(x) for key in self.keys] for x in range(4)]
+        other.add(self.rows, self.keys)
+        for batch in batches:
+            expected.add(self.rows, batch)
+        expected.merge(other)
+
+        threads = [threading.Thread(target=hlls.add, args=(self.rows, batch))
+                   for batch in batches]
+        threads.append(threading.Thread(target=hlls.merge, args=(other,)))
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        self.assertEqual(hlls.merged().registers(),
+                         expected.merged().registers())
+        self.assertEqual(list(hlls.cardinalities()),
+                         list(expected.cardinalities()))
+
+    def test_invalid_arguments_fail(self):
+        hlls = HyperLogLogArray(50, 8)
+        with self.assertRaises(IndexError):
+            hlls.add([50], ['x'])
+        with self.assertRaises(IndexError):
+            hlls.add([-1], ['x'])
+        with self.assertRaises(ValueError):
+            hlls.add([1, 2], ['x'])
+        with self.assertRaises(ValueError):
+            hlls.merge(HyperLogLogArray(40, 8))
+        with self.assertRaises(ValueError):
+            HyperLogLogArray(0, 8)
+
+class TestAsyncIngestor(unittest.TestCase):
+
+    def setUp(self):
+        self.data = [str(i) for i in range(20000)] + ['x' * 100, b'bytes']
+        self.expected = HyperLogLog(10)
+        for item in self.data:
+            self.expected.add(item)
+
+    def test_submit_then_flush_matches_add(self):
+        hll = HyperLogLog(10, threadsafe=True)
+        ingestor = AsyncIngestor(hll)
+        for item in self.data:
+            ingestor.submit(item)
+        ingestor.flush()
+        self.assertEqual(hll.registers(), self.expected.registers())
+
+    def test_makes_hll_threadsafe(self):
+        hll = HyperLogLog(10)
+        self.assertFalse(hll.threadsafe())
+        ingestor = AsyncIngestor(hll)
+        self.assertTrue(hll.threadsafe())
+        ingestor.submit_many(self.data[:10000])
+        hll.add_many(self.data[10000:])
+        ingestor.flush()
+        self.assertEqual(hll.registers(), self.expected.registers())
+
+    def test_reduce_precision_fails_while_attached(self):
+        hll = HyperLogLog(10)
+        ingestor = AsyncIngestor(hll)
+        with self.assertRaises(ValueError):
+            hll.reduce_precision(8)
+        ingestor.close()
+        hll.reduce_precision(8)
+        self.assertEqual(hll.size(), 256)
+
+    def test_submit_many_waits_when_full(self):
+        ingestor = AsyncIngestor(HyperLogLog(10), capacity=3)
+        self.assertEqual(ingestor.capacity(), 4)
+        ingestor.submit_many(iter(self.data))
+        self.assertEqual(ingestor.cardinality(), self.expected.cardinality())
+        self.assertEqual(ingestor.cardinality('raw'),
+                         self.expected.cardinality('raw'))
+
+    def test_concurrent_producers(self):
+        ingestor = AsyncIngestor(HyperLogLog(10), capacity=64)
+
+        def submit(start):
+            ingestor.submit_many(self.data[start::4])
+
+        threads = [threading.Thread(target=submit, args=(x,)) for x in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        ingestor.close()
+        self.assertEqual(ingestor.hll().registers(),
+                         self.expected.registers())
+
+    def test_idle_drain_wakes_for_one_key(self):
+        hll = HyperLogLog(10)
+        expected = HyperLogLog(10)
+        expected.add('a')
+        ingestor = AsyncIngestor(hll)
+        # Long enough for the drain thread to go idle.
+        time.sleep(0.05)
+        ingestor.submit('a')
+        deadline = time.time() + 5
+        while (hll.registers() != expected.registers() and
+               time.time() < deadline):
+            time.sleep(0.001)
+        self.assertEqual(hll.registers(), expected.registers())
+        ingestor.close()
+
+    def test_closed_ingestor_fails(self):
+        ingestor = AsyncIngestor(HyperLogLog(10))
+        ingestor.close()
+        with self.assertRaises(ValueError):
+            ingestor.submit('a')
+
+class TestSharedBuffer(unittest.TestCase):
+
+    def test_registers_live_in_buffer(self):
+        buffer = bytearray(1 << 10)
+        hll = HyperLogLog.from_buffer(buffer, 10, seed=5)
+        self.assertTrue(hll.threadsafe())
+        self.assertEqual(hll.seed(), 5)
+        hll.add('a')
+        self.assertEqual(bytearray(buffer), hll.registers())
+
+    def test_sketches_on_one_buffer_share_registers(self):
+        buffer = bytearray(2048)
+        a = HyperLogLog.from_buffer(buffer, 10)
+        b = HyperLogLog.from_buffer(buffer, 10)
+        expected = HyperLogLog(10)
+        for i in range(5000):
+            (a if i % 2 else b).add(str(i))
+            expected.add(str(i))
+        self.assertEqual(a.registers(), expected.registers())
+        self.assertEqual(b.cardinality(), expected.cardinality())
+
+    def test_small_or_read_only_buffers_fail(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog.from_buffer(bytearray(1023), 10)
+        with self.assertRaises((TypeError, BufferError)):
+            HyperLogLog.from_buffer(b'x' * 1024, 10)
+
+    def test_buffer_cannot_be_resized(self):
+        hll = HyperLogLog.from_buffer(bytearray(1024), 10)
+        with self.assertRaises(ValueError):
+            hll.reduce_precision(8)
+
+class TestCopying(unittest.TestCase):
+
+    def setUp(self):
+        self.hll = HyperLogLog(10, seed=7)
+        for i in range(2000):
+            self.hll.add(str(i))
+
+    def test_copies_are_independent(self):
+        for other in (self.hll.copy(), copy.copy(self.hll),
+                      copy.deepcopy(self.hll), self.hll.snapshot()):
+            self.assertEqual(other.registers(), self.hll.registers())
+            self.assertEqual(other.seed(), 7)
+            self.assertEqual(other.size(), 1024)
+            other.add('new')
+            self.assertNotEqual(other.registers(), self.hll.registers())
+
+    def test_snapshot_keeps_registers_when_original_changes(self):
+        registers = self.hll.registers()
+        snapshots = [self.hll.snapshot() for _ in range(3)]
+        self.hll.add_many(str(i) for i in range(2000, 5000))
+        self.hll.merge(HyperLogLog(12, seed=7))
+        self.hll.set_register(0, 31)
+        for snapshot in snapshots:
+            self.assertEqual(snapshot.registers(), registers)
+
+    def test_snapshot_outlives_original(self):
+        registers = self.hll.registers()
+        snapshot = self.hll.snapshot()
+        del self.hll
+        self.assertEqual(snapshot.registers(), registers)
+        snapshot.reduce_precision(8)
+        self.assertEqual(snapshot.size(), 256)
+
+    def test_threadsafe_snapshot(self):
+        hll = HyperLogLog(10, threadsafe=True)
+        snapshot = hll.snapshot()
+        self.assertTrue(snapshot.threadsafe())
+        hll.add('a')
+        self.assertEqual(snapshot.cardinality(), 0)
+
+class TestExplicit(unittest.TestCase):
+
+    def test_small_cardinalities_are_exact(self):
+        hll = HyperLogLog(10)
+        for i in range(150):
+            hll.add(str(i % 100))
+        self.assertEqual(hll.cardinality(), 100)
+        self.assertEqual(hll.cardinality(estimator='raw'), 100)
+        self.assertEqual(hll.cardinality_with_error(), (100, 0, 100, 100))
+
+    def test_converts_to_registers(self):
+        hll = HyperLogLog(10)
+        dense = HyperLogLog(10, threadsafe=True)
+        for n in (10, 192, 193, 1000):
+            data = [str(i) for i in range(n)]
+            hll.add_many(data)
+            dense.add_many(data)
+            self.assertEqual(hll.registers(), dense.registers())
+            self.assertEqual(hll.register_histogram(),
+                             dense.register_histogram())
+        self.assertEqual(hll.cardinality(), dense.cardinality())
+
+    def test_union_stays_exact(self):
+        a, b = HyperLogLog(10), HyperLogLog(10)
+        a.add_many(str(i) for i in range(50))
+        b.add_many(str(i) for i in range(25, 75))
+        self.assertEqual((a | b).cardinality(), 75)
+        self.assertEqual(HyperLogLog.union([a, b]).cardinality(), 75)
+        a.merge(b)
+        self.assertEqual(a.cardinality(), 75)
+
+    def test_merging_registers_converts(self):
+        hll, dense = HyperLogLog(10), HyperLogLog(10, threadsafe=True)
+        hll.add('a')
+        dense.add('b')
+        hll.merge(dense)
+        dense.add('a')
+        self.assertEqual(hll.registers(), dense.registers())
+        self.assertEqual(hll.cardinality(), dense.cardinality())
+
+    def test_reduce_precision_stays_exact(self):
+        hll, dense = HyperLogLog(12), HyperLogLog(12, threadsafe=True)
+        hll.add_many(str(i) for i in range(100))
+        dense.add_many(str(i) for i in range(100))
+        hll.reduce_precision(10)
+        dense.reduce_precision(10)
+        self.assertEqual(hll.cardinality(), 100)
+        self.assertEqual(hll.registers(), dense.registers())
+
+    def test_copies_and_pickles(self):
+        hll = HyperLogLog(10)
+        hll.add_many(str(i) for i in range(20))
+        for other in (hll.copy(), hll.snapshot(), copy.deepcopy(hll)):
+            self.assertEqual(other.cardinality(), 20)
+            other.add('x')
+            self.assertEqual(hll.cardinality(), 20)
+        unpickled = pickle.loads(pickle.dumps(hll))
+        self.assertEqual(unpickled.registers(), hll.registers())
+
+class TestHashes(unittest.TestCase):
+
+    def test_default_hash_is_murmur3(self):
+        self.assertEqual(HyperLogLog(5).hash(), 'murmur3')
+        self.assertEqual(HyperLogLog(5, hash='wyhash').hash(), 'wyhash')
+
+    def test_unknown_hash_fails(self):
+        with self.assertRaises(ValueError):
+            HyperLogLog(5, hash='md5')
+
+    def test_cardinality_estimation(self):
+        for name in ('murmur3', 'xxh3', 'wyhash'):
+            hll = HyperLogLog(12, hash=name)
+            hll.add_many(str(i) * (i % 40 + 1) for i in range(100000))
+            self.assertTrue(abs(hll.cardinality() - 100000) < 100000 * 0.05)
+
+    def test_hashes_differ(self):
+        registers = set()
+        for name in ('murmur3', 'xxh3', 'wyhash'):
+            hll = HyperLogLog(10, hash=name)
+            for i in range(1000):
+                hll.add(str(i))
+            registers.add(bytes(hll.registers()))
+        self.assertEqual(len(registers), 3)
+
+    def test_different_hashes_cannot_be_merged(self):
+        a = HyperLogLog(10, hash='xxh3')
+        b = HyperLogLog(10)
+        with self.assertRaises(ValueError):
+            a.merge(b)
+        with self.assertRaises(ValueError):
+            HyperLogLog.union([a, b])
+        with self.assertRaises(ValueError):
+            HyperLogLog.jaccard(a, b)
+
+    def test_hash_is_kept(self):
+        hll = HyperLogLog(10, seed=3, hash='xxh3')
+        hll.add('a')
+        for other in (pickle.loads(pickle.dumps(hll)), hll.copy(),
+                      hll | HyperLogLog(10, seed=3, hash='xxh3'),
+                      HyperLogLog.union([hll])):
+            self.assertEqual(other.hash(), 'xxh3')
+            self.assertEqual(other.registers(), hll.registers())
+        self.assertEqual(hll.__reduce__()[1][3], 'xxh3')
+        murmur3 = HyperLogLog(10, seed=3, threadsafe=False)
+        self.assertEqual(murmur3.__reduce__()[1], (10, 3, 0))
+
+    def test_sharded_hash(self):
+        sharded = ShardedHyperLogLog(10, shards=2, hash='wyhash')
+        hll = HyperLogLog(10, hash='wyhash')
+        for i in range(1000):
+            sharded.add(str(i))
+            hll.add(str(i))
+        self.assertEqual(sharded.hash(), 'wyhash')
+        self.assertEqual(sharded.merged().hash(), 'wyhash')
+        self.assertEqual(sharded.merged().registers(), hll.registers())
+
+    def test_grouped_hash(self):
+        grouped = GroupedHyperLogLog(10, hash='wyhash')
+        hll = HyperLogLog(10, hash='wyhash')
+        for i in range(1000):
+            grouped.add('g', str(i))
+            hll.add(str(i))
+        self.assertEqual(grouped.get('g').hash(), 'wyhash')
+        self.assertEqual(grouped.get('g').registers(), hll.registers())
+
+    def test_array_hash(self):
+        hlls = HyperLogLogArray(2, 10, hash='xxh3')
+        hll = HyperLogLog(10, hash='xxh3')
+        keys = [str(i) for i in range(1000)]
+        hlls.add([0] * len(keys), keys)
+        hll.add_many(keys)
+        for other in (hlls.get(0), hlls.merged()):
+            self.assertEqual(other.hash(), 'xxh3')
+            self.assertEqual(other.registers(), hll.registers())
+
+    def test_known_vectors(self):
+        data = [b'', b'a', b'abc', b'message digest',
+                b'abcdefghijklmnopqrstuvwxyz',
+                b'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789',
+                b'1234567890' * 8]
+        xxh3 = [0x2d06800538d394c2, 0xd2f6d0996f37a720, 0xe2af69bada306fec,
+                0x0ce6f354e3d4145c, 0xd4d37f7ee96159cd]
+        wyhash = [0x93228a4de0eec5a2, 0xc5bac3db178713c4, 0xa97f2f7b1d9b3314,
+                  0x786d1f1df3801df4, 0xdca5a8138ad37c87, 0xb9e734f117cfaf70,
+                  0x6cc5eab49a92d617]
+        for name, expected in (('xxh3', xxh3), ('wyhash', wyhash)):
+            for seed, value in enumerate(expected):
+                hll = HyperLogLog(5, seed=seed, hash=name)
+                self.assertEqual(list(hll.hash_many([data[seed]], bits=64)),
+                                 [value])
+
+    def test_hash_many_matches_add(self):
+        data = [str(i) for i in range(20000)]
+        for name in ('murmur3', 'xxh3', 'wyhash'):
+            hll = HyperLogLog(10, hash=name)
+            for element in data:
+                hll.add(element)
+            hashes = hll.hash_many(data)
+            self.assertEqual(len(hashes), len(data))
+            self.assertEqual(memoryview(hashes).format, 'I')
+
+            other = HyperLogLog(10, hash=name)
+            other.add_hashes(hashes)
+            self.assertEqual(other.registers(), hll.registers())
+
+            if name != 'murmur3':
+                wide = hll.hash_many(data, bits=64)
+                self.assertEqual([h >> 32 for h in wide], list(hashes))
+                other = HyperLogLog(10, hash=name)
+                other.add_hashes(wide)
+                self.assertEqual(other.registers(), hll.registers())
+
+    def test_hash_many_hashes_buffer_items(self):
+        hll = HyperLogLog(5, hash='xxh3')
+        self.assertEqual(list(hll.hash_many(bytearray(b'abc'))),
+                         list(hll.hash_many([b'a', b'b', b'c'])))
+        self.assertEqual(len(hll.hash_many(bytearray())), 0)
+
+    @unittest.skipIf(sys.version_info[0] < 3, 'array has no buffer interface')
+    def test_hash_many_hashes_array_items(self):
+        hll = HyperLogLog(5, hash='xxh3')
+        values = array.array('i', [1, 2, 3])
+        expected = [hll.hash_many([struct.pack('=i', v)])[0] for v in values]
+        self.assertEqual(list(hll.hash_many(values)), expected)
+
+        with self.assertRaises(ValueError):
+            hll.add_hashes(array.array('d', [1.0]))
+
+    def test_invalid_hash_widths_fail(self):
+        hll = HyperLogLog(5)
+        with self.assertRaises(ValueError):
+            hll.hash_many(['a'], bits=16)
+        with self.assertRaises(ValueError):
+            hll.hash_many(['a'], bits=64)
+        with self.assertRaises(ValueError):
+            hll.add_hashes(bytearray(8))
+        with self.assertRaises(ValueError):
+            hll.add_hashes(HyperLogLog(5, hash='xxh3').hash_many(['a'], 64))
+
+    def test_murmur3_hash_is_unsigned(self):
+        self.assertEqual(HyperLogLog(5).murmur3_hash('test'), 2727604538)
+
 class TestPickling(unittest.TestCase):
 
     def setUp(self):
@@ -148,6 +1289,14 @@ class TestPickling(unittest.TestCase):
             hll2 = pickle.loads(pickle.dumps(hll))
             self.assertEqual(expected, hll2.seed())
 
+    def test_pickled_threadsafe(self):
+        for hash in ('murmur3', 'xxh3'):
+            for threadsafe in (False, True):
+                hll = HyperLogLog(10, threadsafe=threadsafe, hash=hash)
+                hll2 = pickle.loads(pickle.dumps(hll))
+                self.assertEqual(hll2.threadsafe(), threadsafe)
+                self.assertEqual(hll2.hash(), hash)
+
     def test_pickled_registers(self):
         for hll in self.hlls:
             expected = hll.registers()
@@ -160,6 +1309,28 @@ class TestPickling(unittest.TestCase):
             hll2 = pickle.loads(pickle.dumps(hll))
             self.assertEqual(expected, hll2.size())
 
+    def test_pickled_explicit_stays_exact(self):
+        hll = HyperLogLog(12)
+        for i in range(300):
+            hll.add(str(i))
+        self.assertEqual(hll.cardinality(), 300)
+        hll2 = pickle.loads(pickle.dumps(hll))
+        self.assertEqual(hll2.cardinality(), 300)
+        self.assertEqual(hll2.registers(), hll.registers())
+        hll2.add('300')
+        self.assertEqual(hll2.cardinality(), 301)
+
+    def test_merge_bytes_of_pickled_explicit_stays_exact(self):
+        hll, other = HyperLogLog(12), HyperLogLog(12)
+        for i in range(300):
+            hll.add(str(i))
+            other.add(str(i + 100))
+        other.merge_bytes(hll.__reduce__()[2])
+        self.assertEqual(other.cardinality(), 400)
+        dense = HyperLogLog(12, threadsafe=True)
+        dense.merge_bytes(hll.__reduce__()[2])
+        self.assertEqual(dense.registers(), hll.registers())
+
 class TestRegisterFunctions(unittest.TestCase):
 
     def setUp(self):